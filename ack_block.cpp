@@ -0,0 +1,168 @@
+#include "ack_block.h"
+
+#include <algorithm>
+
+using namespace std;
+
+/* append an unsigned LEB128 varint */
+static void put_varint(uint64_t n, string &out)
+{
+    while (n >= 0x80) {
+        out.push_back(char((n & 0x7f) | 0x80));
+        n >>= 7;
+    }
+    out.push_back(char(n));
+}
+
+/* read an unsigned LEB128 varint at pos and advance pos */
+static uint64_t get_varint(const string &str, size_t &pos)
+{
+    uint64_t n = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos >= str.size()) {
+            throw runtime_error("ack block truncated");
+        }
+        const uint8_t byte = str[pos++];
+        n |= uint64_t(byte & 0x7f) << shift;
+        if (not (byte & 0x80)) {
+            return n;
+        }
+    }
+    throw runtime_error("ack block varint too long");
+}
+
+/* signed deltas (e.g. recv timestamps of reordered packets) as unsigned varints */
+static uint64_t zigzag(const uint64_t delta)
+{
+    const int64_t d = int64_t(delta);
+    return (uint64_t(d) << 1) ^ uint64_t(d >> 63);
+}
+
+static uint64_t unzigzag(const uint64_t n)
+{
+    return (n >> 1) ^ (~(n & 1) + 1);
+}
+
+AckAggregator::AckAggregator(const uint64_t packets_per_ack, const uint64_t max_delay_us)
+    : packets_per_ack_(max(packets_per_ack, uint64_t(1))),
+    max_delay_us_(max_delay_us),
+    records_(),
+    payload_length_(0),
+    first_added_us_(0),
+    lowest_sequence_number_(0),
+    highest_sequence_number_(0)
+{
+    records_.reserve(packets_per_ack_);
+}
+
+/* can this packet join the pending block? */
+bool AckAggregator::fits(const uint64_t sequence_number, const uint64_t payload_length) const
+{
+    if (records_.empty()) {
+        return true;
+    }
+    /* all packets in a block share one payload length and the bitmap span is bounded */
+    const uint64_t lowest = min(lowest_sequence_number_, sequence_number);
+    const uint64_t highest = max(highest_sequence_number_, sequence_number);
+    return payload_length == payload_length_ and highest - lowest < ACK_BLOCK_MAX_SPAN;
+}
+
+/* add a received packet to the pending block */
+void AckAggregator::add(const AckRecord &record, const uint64_t payload_length, const uint64_t now_us)
+{
+    if (records_.empty()) {
+        payload_length_ = payload_length;
+        first_added_us_ = now_us;
+        lowest_sequence_number_ = record.sequence_number;
+        highest_sequence_number_ = record.sequence_number;
+    }
+    lowest_sequence_number_ = min(lowest_sequence_number_, record.sequence_number);
+    highest_sequence_number_ = max(highest_sequence_number_, record.sequence_number);
+    records_.push_back(record);
+}
+
+/* is the pending block due, by size or by age? */
+bool AckAggregator::due(const uint64_t now_us) const
+{
+    if (records_.empty()) {
+        return false;
+    }
+    return full() or (max_delay_us_ > 0 and time_to_flush(now_us) == 0);
+}
+
+/* microseconds until the pending block is due by age (needs a max delay) */
+uint64_t AckAggregator::time_to_flush(const uint64_t now_us) const
+{
+    const uint64_t elapsed = now_us - first_added_us_;
+    return elapsed >= max_delay_us_ ? 0 : max_delay_us_ - elapsed;
+}
+
+/* make an ack block of the pending packets and start a new block */
+Packet AckAggregator::make_ack(const uint64_t sequence_number)
+{
+    sort(records_.begin(), records_.end(),
+         [](const AckRecord &a, const AckRecord &b) { return a.sequence_number < b.sequence_number; });
+    /* a duplicated packet is acked once */
+    records_.erase(unique(records_.begin(), records_.end(),
+                          [](const AckRecord &a, const AckRecord &b) { return a.sequence_number == b.sequence_number; }),
+                   records_.end());
+
+    const AckRecord &base = records_.front();
+    const uint64_t span = records_.back().sequence_number - base.sequence_number + 1;
+
+    string bitmap((span + 7) / 8, '\0');
+    string deltas;
+    const AckRecord *previous = &base;
+    for (const AckRecord &record : records_) {
+        const uint64_t offset = record.sequence_number - base.sequence_number;
+        bitmap[offset / 8] |= char(1 << (offset % 8));
+        if (offset != 0) {
+            put_varint(zigzag(record.send_timestamp - previous->send_timestamp), deltas);
+            put_varint(zigzag(record.recv_timestamp - previous->recv_timestamp), deltas);
+            previous = &record;
+        }
+    }
+
+    string block;
+    put_varint(span, block);
+    block += bitmap + deltas;
+
+    Packet ack(sequence_number, block);
+    ack.header.ack_sequence_number = base.sequence_number;
+    ack.header.ack_send_timestamp = base.send_timestamp;
+    ack.header.ack_recv_timestamp = base.recv_timestamp;
+    ack.header.ack_payload_length = payload_length_;
+
+    records_.clear();
+    return ack;
+}
+
+/* expand an ack block into the per-packet acks it stands for */
+vector<Packet> expand_ack_block(const Packet &ack)
+{
+    size_t pos = 0;
+    const uint64_t span = get_varint(ack.payload, pos);
+    const size_t bitmap_len = (span + 7) / 8;
+    if (span == 0 or span > ACK_BLOCK_MAX_SPAN or ack.payload.size() - pos < bitmap_len) {
+        throw runtime_error("ack block has invalid bitmap");
+    }
+    const string bitmap = ack.payload.substr(pos, bitmap_len);
+    pos += bitmap_len;
+
+    vector<Packet> acks;
+    Packet single(ack.header.sequence_number, "");
+    single.header = ack.header;
+
+    for (uint64_t offset = 0; offset < span; offset++) {
+        if (not (bitmap[offset / 8] & (1 << (offset % 8)))) {
+            continue;
+        }
+        if (offset != 0) {
+            single.header.ack_sequence_number = ack.header.ack_sequence_number + offset;
+            single.header.ack_send_timestamp += unzigzag(get_varint(ack.payload, pos));
+            single.header.ack_recv_timestamp += unzigzag(get_varint(ack.payload, pos));
+        }
+        acks.push_back(single);
+    }
+    return acks;
+}
@@ -0,0 +1,69 @@
+#ifndef UDP_ACK_BLOCK_H
+#define UDP_ACK_BLOCK_H
+
+#include <cstdint>
+#include <vector>
+
+#include "packet.h"
+
+/* Aggregated acks: instead of one ack per data packet, the receiving side
+   sends one ack every k packets or every T us. The ack header describes the
+   lowest sequence number in the block (ack_sequence_number, ack_send_timestamp,
+   ack_recv_timestamp, ack_payload_length) and the payload carries
+
+       varint  span of sequence numbers covered (base .. base + span - 1)
+       bytes   bitmap, bit i set if base + i was received
+       varint  per received packet after base: zigzag delta of send timestamp
+               and zigzag delta of recv timestamp from the previous received packet */
+
+/* one acknowledged data packet */
+struct AckRecord {
+    uint64_t sequence_number;
+    uint64_t send_timestamp;   // **sender's clock**
+    uint64_t recv_timestamp;   // **receiver's clock**
+};
+
+/* collects acks on the receiving side until a block is due */
+class AckAggregator
+{
+public:
+    AckAggregator(uint64_t packets_per_ack, uint64_t max_delay_us);
+
+    /* can this packet join the pending block? */
+    bool fits(uint64_t sequence_number, uint64_t payload_length) const;
+
+    /* add a received packet to the pending block */
+    void add(const AckRecord &record, uint64_t payload_length, uint64_t now_us);
+
+    /* the packets of the pending block */
+    const std::vector<AckRecord> &records() const { return records_; }
+
+    /* is there anything to acknowledge? */
+    bool empty() const { return records_.empty(); }
+
+    /* has the pending block reached k packets? */
+    bool full() const { return records_.size() >= packets_per_ack_; }
+
+    /* is the pending block due, by size or by age? */
+    bool due(uint64_t now_us) const;
+
+    /* microseconds until the pending block is due by age (needs a max delay) */
+    uint64_t time_to_flush(uint64_t now_us) const;
+
+    /* make an ack block of the pending packets and start a new block */
+    Packet make_ack(uint64_t sequence_number);
+
+private:
+    const uint64_t packets_per_ack_;
+    const uint64_t max_delay_us_;
+    std::vector<AckRecord> records_;
+    uint64_t payload_length_;
+    uint64_t first_added_us_;
+    uint64_t lowest_sequence_number_;
+    uint64_t highest_sequence_number_;
+};
+
+/* expand an ack block into the per-packet acks it stands for */
+std::vector<Packet> expand_ack_block(const Packet &ack);
+
+#endif //UDP_ACK_BLOCK_H
@@ -8,47 +8,164 @@
 #include <cmath>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <getopt.h>
 
 #include "packet.h"
 #include "config.h"
+#include "options.h"
+#include "congestion.h"
+#include "ack_block.h"
+#include "send_history.h"
+#include "tuning.h"
+#include "control.h"
+#include "clock_sync.h"
+#include "multi_stream.h"
+#include "pipeline.h"
 
 int client_fd;
 std::ofstream log_file_handler;
 
-struct sockaddr_in peer_addr;
+/* stream buffer of the packet log, sized and pre-faulted before the run */
+char log_buffer[LOG_BUFFER_LEN];
 
-int SENDER_RUNNING = true;
+struct sockaddr_in6 peer_addr;
+
+std::atomic<bool> SENDER_RUNNING(true);
 uint64_t milliseconds_to_sleep, pkts_to_send, duration;
+uint64_t payload_len = PKT_PAYLOAD_LEN;
+
+/* parameters of the current session, agreed on with the server */
+SessionParams session;
+
+/* closed-loop sending (--cc): rate controller fed by acks and its state log */
+std::unique_ptr<RateController> rate_controller;
+std::ofstream cc_log_file_handler;
+
+/* send times of packets in flight, written by the sending thread and read lock-free by the receiving thread */
+SendHistory send_history(SEND_HISTORY_SLOTS);
+RttStats rtt_stats;
+uint64_t loss_reorder_threshold = LOSS_REORDER_THRESHOLD;
 
-bool DEBUG = false;
+/* SO_RXQ_OVFL already reported for the socket */
+uint32_t rxq_dropped = 0;
 
-/* keep receiving packets and send acks (used on receiving side) */
-void recv_packets_and_send_ack(int fd);
+/* loss, duplicates and reordering of the data received over one or more streams */
+StreamReassembly reassembly;
 
-/* use this function to send packets over a socket. */
-void *send_udp_packets(void* fd_ptr);
+/* offset of the peer's clock, from in-band probes, to correct one-way delays */
+ClockSync clock_sync;
 
-/* use this function to receive packets over a socket.
-   the socket must already be connected to an address.*/
-void *recv_udp_packets(void* fd_ptr);
+/* stage timestamps of sampled packets (--trace-stages), written out after the run */
+std::unique_ptr<StageTrace> stage_trace;
+
+/* record the effective run settings as comment lines at the top of the log */
+void write_log_header(const std::vector<std::string> &settings);
+
+/* write the stage timestamps to file_name and their summary to the log */
+void write_stage_trace(const std::string &file_name);
 
 void signalHandler(int signum) {
     shutdown(client_fd, SHUT_RDWR);
     log_file_handler.close(); 
+    cc_log_file_handler.close();
     exit(signum);
 }
 
 int run_client(const char* server_ip, int server_port, const char* log_file_name, double sending_rate_mbps, int time_to_run, bool downlink=true) {
 
+    // initialize signal handler and open log file
+    signal(SIGINT, signalHandler);
+    // a large log buffer, paged in now, keeps flushes and page faults out of the first seconds
+    memset(log_buffer, 0, sizeof(log_buffer));
+    log_file_handler.rdbuf()->pubsetbuf(log_buffer, sizeof(log_buffer));
+    log_file_handler.open(log_file_name);
+
+    // initialize server address: IPv6, or IPv4 as a v4-mapped address
+    memset(&peer_addr, 0, sizeof(struct sockaddr_in6));
+    if (not resolve_address(server_ip, server_port, peer_addr)) {
+        Log("Invalid address or address not supported");
+        pthread_exit(NULL);
+    }
+
+    // initialize UDP socket, for IPv6 and IPv4 servers alike
+    client_fd = dual_stack_udp_socket();
+    if (client_fd < 0) {
+        Error("Socket creation error"); // replace with android logging
+        pthread_exit(NULL);
+    }
+    set_path_mtu_discovery(client_fd);
+    set_timestamps(client_fd);
+    set_rxq_overflow_counter(client_fd);
+
+    // wake up receive loops regularly so they notice the end of the run
+    set_socket_timeout_ms(client_fd, RECV_POLL_INTERVAL_MS);
+
+    // socket tuning; effective settings go to the log header
+    std::vector<std::string> settings;
+    if (run_options.busy_poll_us > 0)
+        settings.push_back(set_busy_poll(client_fd, run_options.busy_poll_us));
+    if (run_options.spin_poll)
+        settings.push_back("spin poll: on");
+    if (run_options.rcvbuf_bytes > 0 or run_options.sndbuf_bytes > 0)
+        settings.push_back(set_socket_buffers(client_fd, run_options.rcvbuf_bytes, run_options.sndbuf_bytes, run_options.force_buffers));
+    if (run_options.mlock)
+        settings.push_back(lock_memory(HEAP_PREFAULT_LEN));
+
+    // propose the run parameters to the server
+    if (run_options.debug)
+        Log("Sending message to the server");
+    SessionParams requested = {};
+    requested.rate_mbps = sending_rate_mbps;
+    requested.duration_s = time_to_run;
+    requested.downlink = downlink;
+    requested.payload_len = run_options.payload_len;
+
+    // data packets must fit the path MTU: fragments would be lost as a whole at high rates
+    uint64_t path_payload_len = path_max_payload_len(peer_addr);
+    if (run_options.payload_fill_mtu) {
+        requested.payload_len = path_payload_len;
+        Log("payload %lu bytes fills the path MTU", path_payload_len);
+    }
+    else if (requested.payload_len > path_payload_len) {
+        Log("payload %u does not fit the path MTU; using %lu", requested.payload_len, path_payload_len);
+        requested.payload_len = path_payload_len;
+    }
+    requested.cc_algorithm = run_options.cc_algorithm;
+    requested.max_rate_mbps = run_options.max_rate_mbps;
+    requested.ack_every = run_options.ack_every;
+    requested.ack_interval_us = run_options.ack_interval_us;
+    requested.streams = run_options.streams;
+    requested.warmup_ms = run_options.warmup_ms;
+    session = client_handshake(client_fd, peer_addr, requested);
+    Log("Communication established with server...");
+    Log("%s", session.get_string().c_str());
+
+    // the server may have adjusted what we asked for
+    run_options.ack_every = session.ack_every;
+    run_options.ack_interval_us = session.ack_interval_us;
+    run_options.cc_algorithm = session.cc_algorithm;
+    run_options.max_rate_mbps = session.max_rate_mbps;
+    payload_len = session.payload_len;
+    sending_rate_mbps = session.rate_mbps;
+    time_to_run = session.duration_s;
+    clock_sync.reset(session.capabilities & CAP_CLOCK_SYNC);
+    if (run_options.trace_stages_every > 0)
+        stage_trace.reset(new StageTrace(run_options.trace_stages_every, STAGE_TRACE_SLOTS));
+    loss_reorder_threshold = stream_reorder_threshold(session.streams);
+
     if (downlink)
         Log("Server -> Client");
     else
         Log("Client -> Server");
 
-    duration = int(time_to_run * 1000);  // in ms
-    double pkts_per_ms = sending_rate_mbps * SENDING_RATE_CONST;
+    duration = uint64_t(time_to_run) * 1000;  // in ms
+    double rate_const = sending_rate_const(payload_len);
+    double pkts_per_ms = sending_rate_mbps * rate_const;
 
-    if ((1.0 / SENDING_RATE_CONST) > sending_rate_mbps) {  // if sending rate < 1 pkt/ms
+    if ((1.0 / rate_const) > sending_rate_mbps) {  // if sending rate < 1 pkt/ms
         milliseconds_to_sleep = std::max(1, int(std::round(1.0 / pkts_per_ms)));
         pkts_to_send = 1;
     }
@@ -59,184 +176,122 @@ int run_client(const char* server_ip, int server_port, const char* log_file_name
 
     Log("sleep time %d; pkts to send %d", milliseconds_to_sleep, pkts_to_send);
 
-    // initialize signal handler and open log file
-    signal(SIGINT, signalHandler);
-    log_file_handler.open(log_file_name);
-
-    // initialize server address
-    memset(&peer_addr, 0, sizeof(struct sockaddr_in));
-    peer_addr.sin_family = AF_INET;
-    peer_addr.sin_port = htons(server_port);
-    if (inet_pton(AF_INET, server_ip, &peer_addr.sin_addr) <= 0) {
-        Log("Invalid address or address not supported");
-        pthread_exit(NULL);
-    }
-
-    // initialize UDP socket
-    client_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (client_fd < 0) {
-        Error("Socket creation error"); // replace with android logging
-        pthread_exit(NULL);
+    // closed-loop sending: the rate controller starts at the requested rate
+    if (!downlink and not run_options.cc_algorithm.empty()) {
+        rate_controller = make_rate_controller(run_options.cc_algorithm, sending_rate_mbps, run_options.max_rate_mbps);
+        cc_log_file_handler.open(companion_file_name(log_file_name, "cc"));
+        cc_log_file_handler << rate_controller->get_state_header() << "\n";
+        Log("rate controller %s; initial rate %.3f Mbps", rate_controller->name(), rate_controller->pacing_rate_mbps());
     }
-    set_timestamps(client_fd);
 
-    // send first packet to server and wait for 2 packets to establish communication
-    if (DEBUG)
-        Log("Sending message to the server");
-    char* recv_data = (char*)malloc(RECV_BUFFER_LEN);
-    sendto(client_fd, "Test1\n", strlen("Test1\n"), 0, (struct sockaddr *) &peer_addr, sizeof(peer_addr));
-    socklen_t peer_addr_len = sizeof(peer_addr);
-    recvfrom(client_fd, recv_data, RECV_BUFFER_LEN, 0, (struct sockaddr *) &peer_addr, &peer_addr_len);
-    recvfrom(client_fd, recv_data, RECV_BUFFER_LEN, 0, (struct sockaddr *) &peer_addr, &peer_addr_len);
-    sendto(client_fd, "Test2_ACK\n", strlen("Test2_ACK\n"), 0, (struct sockaddr *) &peer_addr, sizeof(peer_addr));
-    Log("Communication established with server...");
+    // connect socket to the server address; streams of the server come from several ports
+    if (!downlink or session.streams == 1)
+        connect_socket_to_address(client_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr));
 
-    // connect socket to the server address
-    connect_socket_to_address(client_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr));
+    // the loops of the run share its state through the pipeline
+    Pipeline pipeline = {client_fd, peer_addr, true, &session, duration, payload_len, milliseconds_to_sleep,
+                         pkts_to_send, loss_reorder_threshold, &SENDER_RUNNING, rate_controller.get(),
+                         &send_history, &rtt_stats, &clock_sync, &reassembly, &rxq_dropped,
+                         stage_trace.get(), &log_file_handler, &cc_log_file_handler};
 
     if (downlink) {
         // start receiving packets and send acks
-        recv_packets_and_send_ack(client_fd);
+        settings.push_back(tune_current_thread("recv", run_options.recv_cpu, run_options.rt_priority));
+        write_log_header(settings);
+        recv_packets_and_send_ack(pipeline);
+        Log("%s", reassembly.get_string().c_str());
+        log_file_handler << "# " << reassembly.get_string() << "\n";
+    }
+    else if (session.streams > 1) {
+        // one thread per stream for sending packets, one for receiving acks
+        StreamSenders stream_senders(session.streams, run_options.send_cpu, run_options.rt_priority);
+        TunedThread recv_worker("recv", run_options.recv_cpu, run_options.rt_priority);
+        for (const std::string &setting : stream_senders.effective())
+            settings.push_back(setting);
+        settings.push_back(recv_worker.effective());
+        write_log_header(settings);
+
+        recv_worker.run(recv_udp_packets, (void*) &pipeline);
+        StreamFlow flow = {client_fd, peer_addr, duration, payload_len, sending_rate_mbps,
+                           rate_controller.get(), &send_history, stage_trace.get(), &SENDER_RUNNING};
+        send_stream_flow(pipeline, stream_senders, flow);
+        Log("stream sender threads returned");
+        recv_worker.wait();
+        Log("Recv thread returned");
+        Log("%s", rtt_stats.get_string().c_str());
     }
     else {
         // create two threads: one for sending packets and one for receiving
-        pthread_t send_thread, recv_thread;
-        pthread_create(&send_thread, NULL, send_udp_packets, (void*) &client_fd);
-        pthread_create(&recv_thread, NULL, recv_udp_packets, (void*) &client_fd);
+        TunedThread send_worker("send", run_options.send_cpu, run_options.rt_priority);
+        TunedThread recv_worker("recv", run_options.recv_cpu, run_options.rt_priority);
+        settings.push_back(send_worker.effective());
+        settings.push_back(recv_worker.effective());
+        write_log_header(settings);
 
-        pthread_join(send_thread, NULL);
+        send_worker.run(send_udp_packets, (void*) &pipeline);
+        recv_worker.run(recv_udp_packets, (void*) &pipeline);
+        send_worker.wait();
         Log("sender thread returned");
-        pthread_join(recv_thread, NULL);
+        recv_worker.wait();
         Log("Recv thread returned");
+        Log("%s", rtt_stats.get_string().c_str());
     }
 
+    // clock offset of the server, to correct one-way delays offline
+    Log("%s", clock_sync.get_string().c_str());
+    log_file_handler << "# " << clock_sync.get_string() << "\n";
+
+    // where the time of the sampled packets went, next to the log
+    if (stage_trace)
+        write_stage_trace(companion_file_name(log_file_name, "stages"));
+
+    // datagrams lost inside this host, to tell them apart from path loss
+    std::string host_drops = get_host_drops().get_string();
+    Log("%s", host_drops.c_str());
+    log_file_handler << "# " << host_drops << "\n";
+
     shutdown(client_fd, SHUT_RDWR);
     log_file_handler.close();
+    cc_log_file_handler.close();
 
     return 1;
 }
 
 int main(int argc, char** argv) {
-    if (argc == 7) {
-        char* server_ip = argv[1];
-        int server_port = std::atoi(argv[2]);
-        char* log_file_name = argv[3];
-        double sending_rate = std::atof(argv[4]);
-        int time_to_run = std::atoi(argv[5]);
-        bool downlink = strcmp(argv[6], "UP") == 0 ? false : true;
+    // the first packets should not pay for lazy clocks and fresh stack pages
+    init_clocks();
+    prefault_stack();
+    if (parse_run_options(argc, argv) and argc - optind == 6) {
+        char** args = argv + optind;
+        char* server_ip = args[0];
+        int server_port = std::atoi(args[1]);
+        char* log_file_name = args[2];
+        double sending_rate = std::atof(args[3]);
+        int time_to_run = std::atoi(args[4]);
+        bool downlink = strcmp(args[5], "UP") == 0 ? false : true;
         return run_client(server_ip, server_port, log_file_name, sending_rate, time_to_run, downlink);
     }
     else {
+        Log("Usage: %s IP PORT LOG_FILE SENDING_RATE DURATION DOWN/UP [options]", argv[0]);
+        print_run_options_usage();
         return 0;
     }
 }
 
-/* keep receiving packets and send acks (used on receiving side) */
-void recv_packets_and_send_ack(int fd) {
-    int client_seq_no = 1;
-
-    while (true) {
-        received_datagram message = recv_packet(fd);
-        Packet packet = message.payload;
-        if (DEBUG) {
-            Log("Custom message received ==> %d, %d, %d, %d, %d, %d, %d, %d", 
-                            packet.is_ack(), 
-                            packet.header.sequence_number, 
-                            packet.header.send_timestamp, 
-                            packet.header.ack_sequence_number, 
-                            packet.header.ack_send_timestamp, 
-                            packet.header.ack_recv_timestamp, 
-                            message.timestamp,
-                            packet.header.ack_payload_length);
-        }
-        std::string packet_info = string_format("%d, %d, %d, %d, %d, %d, %d, %d, %d\n", 
-                                                packet.is_ack(),
-                                                packet.header.sequence_number, 
-                                                packet.header.send_timestamp, 
-                                                packet.header.ack_sequence_number, 
-                                                packet.header.ack_send_timestamp, 
-                                                packet.header.ack_recv_timestamp,
-                                                message.timestamp,
-                                                packet.header.ack_payload_length,
-                                                get_current_timestamp());
-        log_file_handler << packet_info;
-        if (packet.header.sequence_number <= 0) {
-            Log("Last packet received (exiting)!");
-            break;
-        }
-        if (timestamp_ms() >= duration) {
-            Log("Experiment duration elapsed (exiting)!");
-            break;
-        }
-        packet.transform_into_ack(client_seq_no++, message.timestamp);
-        packet.set_send_timestamp();
-        send_packet(fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), packet.to_string());
-    }
-}
-
-/* use this function to send packets over a socket. */
-void *send_udp_packets(void* fd_ptr)
-{
-    int server_seq_no = 1;
-    int socket_fd = *((int*) fd_ptr);
-    uint64_t start_time_ms = timestamp_ms();
-
-    int count = 0;
-    while ((timestamp_ms() - start_time_ms) <= duration and SENDER_RUNNING) {
-        while (count++ < pkts_to_send) {
-            // send packets
-            std::string message = create_packet(server_seq_no++);
-            send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-            if (DEBUG)
-                Log("Custom message sent");
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds_to_sleep));
-        count = 0;
+/* record the effective run settings as comment lines at the top of the log */
+void write_log_header(const std::vector<std::string> &settings) {
+    if (not run_options.tuning_requested())
+        return;
+    for (const std::string &setting : settings) {
+        Log("%s", setting.c_str());
+        log_file_handler << "# " << setting << "\n";
     }
-    std::string message = create_packet(0);
-    // send a few times just in case
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    if (DEBUG)
-        Log("Last Custom message sent");
-    SENDER_RUNNING = false;
 }
 
-/* use this function to receive packets over a socket.
-   the socket must already be connected to an address.*/
-void *recv_udp_packets(void* fd_ptr)
-{
-    int socket_fd = *((int*) fd_ptr);
-    set_socket_timeout(socket_fd, SERVER_RECV_MSG_TIMEOUT);
-
-    // recv acks and log them
-    while (SENDER_RUNNING) {
-        received_datagram recv_message = recv_packet(socket_fd); // this will exit the thread if timeout
-        Packet packet = recv_message.payload;
-        if (DEBUG) {
-                Log("Custom message received ==> %d, %d, %d, %d, %d, %d, %d, %d", 
-                            packet.is_ack(), 
-                            packet.header.sequence_number, 
-                            packet.header.send_timestamp, 
-                            packet.header.ack_sequence_number, 
-                            packet.header.ack_send_timestamp, 
-                            packet.header.ack_recv_timestamp, 
-                            recv_message.timestamp,
-                            packet.header.ack_payload_length);
-        }
-        std::string packet_info = string_format("%d, %d, %d, %d, %d, %d, %d, %d, %d\n", 
-                                                packet.is_ack(),
-                                                packet.header.sequence_number, 
-                                                packet.header.send_timestamp, 
-                                                packet.header.ack_sequence_number, 
-                                                packet.header.ack_send_timestamp, 
-                                                packet.header.ack_recv_timestamp,
-                                                recv_message.timestamp,
-                                                packet.header.ack_payload_length,
-                                                get_current_timestamp());
-        log_file_handler << packet_info;
-    }
+/* write the stage timestamps to file_name and their summary to the log */
+void write_stage_trace(const std::string &file_name) {
+    std::ofstream stage_file(file_name);
+    stage_trace->write(stage_file);
+    Log("%s; details in %s", stage_trace->get_string().c_str(), file_name.c_str());
+    log_file_handler << "# " << stage_trace->get_string() << "\n";
 }
@@ -0,0 +1,201 @@
+#include "clock_sync.h"
+#include "config.h"
+#include "timestamp.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+/* length of every clock message on the wire */
+static const size_t CLOCK_MESSAGE_LEN = 32;
+
+enum ClockType : uint8_t {
+    CLOCK_PROBE = 1,
+    CLOCK_REPLY = 2,
+};
+
+/* the four timestamps of an exchange; t4 never goes on the wire */
+struct ClockMessage {
+    uint8_t type;
+    uint64_t t1, t2, t3;
+};
+
+static string to_wire(const ClockMessage &message)
+{
+    string out(CLOCK_MESSAGE_LEN, '\0');
+    const uint32_t magic = htobe32(CLOCK_MAGIC);
+    memcpy(&out[0], &magic, sizeof(magic));
+    out[4] = char(message.type);
+    const uint64_t times[3] = {htobe64(message.t1), htobe64(message.t2), htobe64(message.t3)};
+    memcpy(&out[8], times, sizeof(times));
+    return out;
+}
+
+static ClockMessage from_wire(const string &payload)
+{
+    ClockMessage message;
+    uint64_t times[3];
+    message.type = uint8_t(payload[4]);
+    memcpy(times, &payload[8], sizeof(times));
+    message.t1 = be64toh(times[0]);
+    message.t2 = be64toh(times[1]);
+    message.t3 = be64toh(times[2]);
+    return message;
+}
+
+/* Is this datagram a clock message? */
+bool is_clock_message(const string &payload)
+{
+    if (payload.size() != CLOCK_MESSAGE_LEN) {
+        return false;
+    }
+    uint32_t magic;
+    memcpy(&magic, payload.data(), sizeof(magic));
+    return be32toh(magic) == CLOCK_MAGIC;
+}
+
+ClockSync::ClockSync()
+    : enabled_(false),
+    probes_sent_(0),
+    next_probe_us_(0),
+    samples_(),
+    reference_(),
+    drift_ppm_(0.0)
+{}
+
+/* forget all samples, before a new session; probes are only sent when enabled */
+void ClockSync::reset(const bool enabled)
+{
+    enabled_ = enabled;
+    probes_sent_ = 0;
+    next_probe_us_ = 0;
+    samples_.clear();
+    reference_ = Sample();
+    drift_ppm_ = 0.0;
+}
+
+/* is a probe due at local time now_us? */
+bool ClockSync::probe_due(const uint64_t now_us) const
+{
+    return enabled_ and now_us >= next_probe_us_;
+}
+
+/* make a probe and schedule the next one */
+string ClockSync::make_probe(const uint64_t now_us)
+{
+    probes_sent_++;
+    const uint64_t interval_ms = probes_sent_ < CLOCK_PROBE_BURST ? CLOCK_PROBE_BURST_INTERVAL_MS : CLOCK_PROBE_INTERVAL_MS;
+    next_probe_us_ = now_us + interval_ms * 1000;
+    return to_wire({CLOCK_PROBE, now_us, 0, 0});
+}
+
+/* handle a clock message from the peer: returns the reply to a probe,
+   or "" after taking the sample of a reply */
+string ClockSync::on_message(const string &payload)
+{
+    const uint64_t now_us = log_timestamp_us();
+    ClockMessage message = from_wire(payload);
+
+    if (message.type == CLOCK_PROBE) {
+        message.type = CLOCK_REPLY;
+        message.t2 = now_us;
+        message.t3 = log_timestamp_us();
+        return to_wire(message);
+    }
+    if (message.type == CLOCK_REPLY and message.t1 <= now_us) {
+        const double t1 = message.t1, t2 = message.t2, t3 = message.t3, t4 = now_us;
+        add_sample({message.t1 + (now_us - message.t1) / 2,
+                    ((t2 - t1) + (t3 - t4)) / 2.0,
+                    max(0.0, (t4 - t1) - (t3 - t2))});
+    }
+    return "";
+}
+
+/* keep the sample, pick the reference among the latest ones and refit the drift */
+void ClockSync::add_sample(const Sample &sample)
+{
+    samples_.push_back(sample);
+    if (samples_.size() > CLOCK_MAX_SAMPLES) {
+        samples_.pop_front();
+    }
+
+    /* queueing only ever adds delay, so the fastest exchange gives the best offset */
+    const size_t recent = min(samples_.size(), size_t(CLOCK_FILTER_SAMPLES));
+    reference_ = *min_element(samples_.end() - recent, samples_.end(),
+                              [](const Sample &a, const Sample &b) { return a.rtt_us < b.rtt_us; });
+
+    /* least-squares slope of the offset over the low-delay samples */
+    double min_rtt_us = samples_.front().rtt_us;
+    for (const Sample &s : samples_) {
+        min_rtt_us = min(min_rtt_us, s.rtt_us);
+    }
+    double n = 0, mean_t = 0, mean_offset = 0;
+    uint64_t first_us = -1, last_us = 0;
+    for (const Sample &s : samples_) {
+        if (s.rtt_us > min_rtt_us + CLOCK_DRIFT_RTT_SLACK_US) {
+            continue;
+        }
+        n++;
+        mean_t += (double(s.local_us - samples_.front().local_us) - mean_t) / n;
+        mean_offset += (s.offset_us - mean_offset) / n;
+        first_us = min(first_us, s.local_us);
+        last_us = max(last_us, s.local_us);
+    }
+    if (n < 2 or last_us - first_us < CLOCK_DRIFT_MIN_SPAN_MS * 1000) {
+        drift_ppm_ = 0.0;
+        return;
+    }
+    double covariance = 0, variance = 0;
+    for (const Sample &s : samples_) {
+        if (s.rtt_us > min_rtt_us + CLOCK_DRIFT_RTT_SLACK_US) {
+            continue;
+        }
+        const double dt = double(s.local_us - samples_.front().local_us) - mean_t;
+        covariance += dt * (s.offset_us - mean_offset);
+        variance += dt * dt;
+    }
+    drift_ppm_ = variance > 0 ? covariance / variance * 1e6 : 0.0;
+}
+
+/* estimated peer clock minus local clock at local time now_us */
+double ClockSync::offset_us(const uint64_t now_us) const
+{
+    return reference_.offset_us + drift_ppm_ * 1e-6 * (double(now_us) - double(reference_.local_us));
+}
+
+/* offset-corrected one-way delays of a logged packet received at recv_timestamp */
+OneWayDelays ClockSync::one_way_delays(const Packet &packet, const uint64_t recv_timestamp, const bool local_is_client) const
+{
+    double towards_local = NAN, towards_peer = NAN;
+    if (valid()) {
+        const double offset_ms = offset_us(log_timestamp_us()) / 1000.0;
+        const uint64_t unknown = -1;
+
+        /* this packet came from the peer */
+        if (recv_timestamp != unknown and packet.header.send_timestamp != unknown)
+            towards_local = double(recv_timestamp) - double(packet.header.send_timestamp) + offset_ms;
+
+        /* an ack also tells how long our packet took to the peer */
+        if (packet.is_ack() and packet.header.ack_send_timestamp != unknown and packet.header.ack_recv_timestamp != unknown)
+            towards_peer = double(packet.header.ack_recv_timestamp) - offset_ms - double(packet.header.ack_send_timestamp);
+    }
+    if (local_is_client)
+        return {towards_peer, towards_local};
+    return {towards_local, towards_peer};
+}
+
+/* Make human-readable representation */
+string ClockSync::get_string() const
+{
+    if (not valid()) {
+        return string_format("clock offset: unknown (%lu probes, no reply)", probes_sent_);
+    }
+    return string_format("clock offset: %.1f us (peer - local); drift %.3f ppm; rtt %.1f us; %lu samples",
+                         offset_us(log_timestamp_us()),
+                         drift_ppm_,
+                         reference_.rtt_us,
+                         samples_.size());
+}
@@ -0,0 +1,85 @@
+#ifndef UDP_CLOCK_SYNC_H
+#define UDP_CLOCK_SYNC_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+
+#include "packet.h"
+
+/* In-band clock synchronization. Each side probes the other NTP-style:
+
+       local                        peer
+       PROBE(t1)              -->   t2
+                              <--   REPLY(t1, t2, t3)
+       t4
+
+   offset = ((t2 - t1) + (t3 - t4)) / 2, rtt = (t4 - t1) - (t3 - t2).
+   Times are in microseconds on the clock of the logs (timestamp_ms), so the
+   offset also covers the different program start times of the two hosts.
+   A burst of probes at the start of a session gives a first estimate; later
+   probes track the drift. Clock messages start with CLOCK_MAGIC where data
+   packets carry the upper half of their sequence number. */
+
+const uint32_t CLOCK_MAGIC = 0x55445054; // "UDPT"
+
+/* offset-corrected one-way delays of a logged packet in ms (NAN = unknown) */
+struct OneWayDelays {
+    double up_ms;      // client -> server
+    double down_ms;    // server -> client
+};
+
+class ClockSync
+{
+public:
+    ClockSync();
+
+    /* forget all samples, before a new session; probes are only sent when enabled */
+    void reset(bool enabled);
+
+    /* is a probe due at local time now_us? */
+    bool probe_due(uint64_t now_us) const;
+
+    /* make a probe and schedule the next one */
+    std::string make_probe(uint64_t now_us);
+
+    /* handle a clock message from the peer: returns the reply to a probe,
+       or "" after taking the sample of a reply */
+    std::string on_message(const std::string &payload);
+
+    /* has a reply been seen yet? */
+    bool valid() const { return not samples_.empty(); }
+
+    /* estimated peer clock minus local clock at local time now_us */
+    double offset_us(uint64_t now_us) const;
+
+    /* estimated drift of the peer clock against ours, in ppm */
+    double drift_ppm() const { return drift_ppm_; }
+
+    /* offset-corrected one-way delays of a logged packet received at recv_timestamp */
+    OneWayDelays one_way_delays(const Packet &packet, uint64_t recv_timestamp, bool local_is_client) const;
+
+    /* Make human-readable representation */
+    std::string get_string() const;
+
+private:
+    struct Sample {
+        uint64_t local_us;   // midpoint of the exchange
+        double offset_us;
+        double rtt_us;
+    };
+
+    void add_sample(const Sample &sample);
+
+    bool enabled_;
+    uint64_t probes_sent_;
+    uint64_t next_probe_us_;
+    std::deque<Sample> samples_;
+    Sample reference_;       // lowest-rtt recent sample
+    double drift_ppm_;
+};
+
+/* Is this datagram a clock message? */
+bool is_clock_message(const std::string &payload);
+
+#endif //UDP_CLOCK_SYNC_H
@@ -1,12 +1,84 @@
 #ifndef UDP_CONFIG_H
 #define UDP_CONFIG_H
 
+#include <cstdint>
+
 const uint64_t PKT_PAYLOAD_LEN = 1200; // in bytes
+const uint64_t MAX_PAYLOAD_LEN = 65000; // in bytes
 const uint64_t RECV_BUFFER_LEN = 65536; // in bytes
+const uint64_t IPV4_HEADER_LEN = 20; // without options, in bytes
+const uint64_t IPV6_HEADER_LEN = 40; // without extension headers, in bytes
+const uint64_t UDP_HEADER_LEN = 8; // in bytes
 const uint16_t SERVER_RECV_MSG_TIMEOUT = 15; // in secs
+const uint64_t RECV_POLL_INTERVAL_MS = 100; // receive loops wake up this often to check for the end of a run
+const uint64_t ACK_DRAIN_MS = 1000; // keep receiving acks this long after the last packet was sent
 const double BITS_PER_BYTE = 8.0;
 const double KILO = 1024.0;
 const double MEGA = KILO * KILO;
 const double SENDING_RATE_CONST = (MEGA / BITS_PER_BYTE) / ((double)PKT_PAYLOAD_LEN * 1000.0);  // pkts per ms
 
+/* pkts per ms per Mbps for a payload length other than PKT_PAYLOAD_LEN */
+inline double sending_rate_const(uint64_t payload_len)
+{
+    return (MEGA / BITS_PER_BYTE) / ((double)payload_len * 1000.0);
+}
+
+/* start-up preparation, so the first packets of a run do not pay for it */
+const uint64_t STACK_PREFAULT_LEN = 256 * 1024; // stack each worker thread touches before its first job, in bytes
+const uint64_t HEAP_PREFAULT_LEN = 16 << 20; // heap pre-faulted and kept with --mlock, in bytes
+const uint64_t LOG_BUFFER_LEN = 1 << 20; // stream buffer of the packet log, in bytes
+const uint64_t MAX_WARMUP_MS = 10000; // longest warm-up burst before the measured interval
+
+/* session handshake */
+const uint64_t CONTROL_RETRY_MS = 200; // retransmit unanswered control messages after this long
+const uint64_t CONTROL_RETRIES = 25; // give up after this many retransmissions
+const double MAX_SESSION_RATE_MBPS = 10000.0; // most a client may ask the server to send or take, also for --cc
+const uint32_t MAX_SESSION_DURATION_S = 3600; // longest session a client may ask for
+
+/* multi-stream sending */
+const uint64_t MAX_STREAMS = 64;
+const uint64_t STREAM_SEQ_BLOCK = 32; // sequence numbers a sending thread takes at a time
+const uint64_t REASSEMBLY_WINDOW = 1 << 16; // packets remembered by the receiver to spot duplicates
+
+/* in-band clock synchronization */
+const uint64_t CLOCK_PROBE_BURST = 8; // probes at the start of a session
+const uint64_t CLOCK_PROBE_BURST_INTERVAL_MS = 20;
+const uint64_t CLOCK_PROBE_INTERVAL_MS = 1000; // probes during the run, to follow the drift
+const uint64_t CLOCK_FILTER_SAMPLES = 8; // the offset is taken from the lowest-rtt of the last samples
+const uint64_t CLOCK_MAX_SAMPLES = 256;
+const uint64_t CLOCK_DRIFT_MIN_SPAN_MS = 5000; // estimate drift only over samples this far apart
+const double CLOCK_DRIFT_RTT_SLACK_US = 200.0; // drift fit uses samples with rtt this close to the minimum
+
+/* closed-loop rate control */
+const uint64_t CC_UPDATE_INTERVAL_MS = 10; // shortest interval between rate decisions
+const double CC_MIN_RATE_MBPS = 0.1; // never pace slower than this
+const double CC_MAX_BURST_MS = 4.0; // unused sending credit is capped at this many ms worth of packets
+const double AIMD_ADDITIVE_INCREASE_MBPS = 0.5; // added once per round trip without loss
+const double AIMD_MULTIPLICATIVE_DECREASE = 0.5; // applied at most once per round trip on loss
+const double BBR_STARTUP_GAIN = 2.885; // 2/ln(2)
+const double BBR_FULL_BW_GROWTH = 1.25; // startup ends when bandwidth stops growing by this factor
+const uint64_t BBR_FULL_BW_ROUNDS = 3; // ... for this many rounds
+const uint64_t BBR_BW_WINDOW_ROUNDS = 10; // bottleneck bandwidth is the max over this many rounds
+const uint64_t BBR_MIN_RTT_WINDOW_MS = 10000; // min rtt expires after this long
+
+/* aggregated acks */
+const uint64_t ACK_BLOCK_MAX_PACKETS = 1024; // most packets acknowledged by one block
+const uint64_t ACK_BLOCK_MAX_SPAN = 4096; // most sequence numbers covered by one block's loss bitmap
+const uint64_t ACK_INTERVAL_MAX_US = 1000000; // longest a pending ack block may wait (--ack-interval)
+
+/* send history for live rtt and loss accounting on the sending side */
+const uint64_t SEND_HISTORY_SLOTS = 1 << 17; // packets remembered (power of two)
+const uint64_t LOSS_REORDER_THRESHOLD = 3; // a packet is lost once a packet this far beyond it is acked
+const uint64_t RTT_STATS_INTERVAL_MS = 1000; // how often live rtt statistics are printed
+
+/* per-packet stage timestamps (--trace-stages) */
+const uint64_t STAGE_TRACE_SLOTS = 1 << 16; // sampled packets remembered (power of two)
+
+/* AF_XDP data path of the ack reflector */
+const uint64_t XDP_NUM_FRAMES = 4096; // frames in the UMEM
+const uint64_t XDP_FRAME_SIZE = 4096; // bytes per frame (one page)
+const uint32_t XDP_RING_SIZE = 2048; // descriptors per ring (power of two)
+const uint64_t XDP_TX_RESERVE = 64; // frames kept out of the fill ring for acks
+const uint64_t XDP_SOCKET_CHECK_EVERY = 64; // frames taken between checks of the socket while the ring is busy
+
 #endif //UDP_CONFIG_H
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "congestion.h"
+#include "config.h"
+#include "utils.h"
+
+#include <algorithm>
+
+using namespace std;
+
+/* BBR pacing gain cycle used in PROBE_BW */
+static const double BBR_PACING_GAIN_CYCLE[] = {1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+static const uint64_t BBR_PACING_GAIN_CYCLE_LEN = sizeof(BBR_PACING_GAIN_CYCLE) / sizeof(double);
+
+/* convert bytes delivered over an interval in ms to Mbps */
+static double delivery_rate(const uint64_t bytes, const uint64_t interval_ms)
+{
+    if (interval_ms == 0) {
+        return 0.0;
+    }
+    return (bytes * BITS_PER_BYTE / MEGA) / (interval_ms / 1000.0);
+}
+
+RateController::RateController(const double initial_rate_mbps, const double max_rate_mbps)
+    : now_(0),
+    latest_rtt_(0),
+    min_rtt_(-1),
+    srtt_(0.0),
+    highest_acked_(0),
+    newly_lost_(0),
+    total_lost_(0),
+    delivered_bytes_(0),
+    max_rate_mbps_(max_rate_mbps),
+    pacing_rate_mbps_(0.0)
+{
+    set_pacing_rate(initial_rate_mbps);
+}
+
+/* set pacing rate, clamped to [CC_MIN_RATE_MBPS, max_rate_mbps] */
+void RateController::set_pacing_rate(double rate_mbps)
+{
+    if (max_rate_mbps_ > 0) {
+        rate_mbps = min(rate_mbps, max_rate_mbps_);
+    }
+    pacing_rate_mbps_.store(max(rate_mbps, CC_MIN_RATE_MBPS), memory_order_relaxed);
+}
+
+/* update the bookkeeping shared by all algorithms from an ack */
+void RateController::account(const AckSample &ack)
+{
+    now_ = ack.recv_timestamp;
+
+    /* rtt: both timestamps are on our clock */
+    latest_rtt_ = now_ > ack.send_timestamp ? now_ - ack.send_timestamp : 0;
+    min_rtt_ = min(min_rtt_, latest_rtt_);
+    srtt_ = srtt_ == 0.0 ? latest_rtt_ : 0.875 * srtt_ + 0.125 * latest_rtt_;
+
+    /* losses are declared by the send history, which tolerates reordering
+       (packets of several streams are acked out of order) */
+    newly_lost_ = ack.lost;
+    highest_acked_ = max(highest_acked_, ack.sequence_number);
+    total_lost_ += newly_lost_;
+    delivered_bytes_ += ack.payload_length;
+}
+
+/* csv header describing the controller state */
+string RateController::get_state_header() const
+{
+    return "timestamp, algorithm, pacing_rate_mbps, latest_rtt, min_rtt, srtt, highest_acked, total_lost, delivered_bytes, "
+           + get_algorithm_state_header();
+}
+
+/* csv row describing the controller state */
+string RateController::get_state() const
+{
+    return string_format("%lu, %s, %.3f, %lu, %lu, %.2f, %lu, %lu, %lu, ",
+                         now_,
+                         name(),
+                         pacing_rate_mbps(),
+                         latest_rtt_,
+                         min_rtt_,
+                         srtt_,
+                         highest_acked_,
+                         total_lost_,
+                         delivered_bytes_)
+           + get_algorithm_state();
+}
+
+AIMDController::AIMDController(const double initial_rate_mbps, const double max_rate_mbps)
+    : RateController(initial_rate_mbps, max_rate_mbps),
+    last_increase_(0),
+    last_decrease_(0),
+    decreases_(0)
+{}
+
+bool AIMDController::update(const AckSample &)
+{
+    /* react at most once per round trip */
+    const uint64_t interval = max(uint64_t(srtt_), CC_UPDATE_INTERVAL_MS);
+
+    if (newly_lost_ > 0) {
+        if (now_ - last_decrease_ < interval) {
+            return false;
+        }
+        set_pacing_rate(pacing_rate_mbps() * AIMD_MULTIPLICATIVE_DECREASE);
+        last_decrease_ = now_;
+        last_increase_ = now_;
+        decreases_++;
+        return true;
+    }
+
+    if (now_ - last_increase_ < interval) {
+        return false;
+    }
+    set_pacing_rate(pacing_rate_mbps() + AIMD_ADDITIVE_INCREASE_MBPS);
+    last_increase_ = now_;
+    return true;
+}
+
+string AIMDController::get_algorithm_state_header() const
+{
+    return "decreases";
+}
+
+string AIMDController::get_algorithm_state() const
+{
+    return string_format("%lu", decreases_);
+}
+
+BBRController::BBRController(const double initial_rate_mbps, const double max_rate_mbps)
+    : RateController(initial_rate_mbps, max_rate_mbps),
+    mode_(STARTUP),
+    pacing_gain_(BBR_STARTUP_GAIN),
+    cycle_index_(0),
+    round_start_(0),
+    round_start_delivered_(0),
+    min_rtt_timestamp_(0),
+    delivery_rate_mbps_(0.0),
+    btl_bw_mbps_(0.0),
+    bw_samples_(),
+    full_bw_mbps_(0.0),
+    full_bw_rounds_(0)
+{}
+
+/* length of one round in ms */
+uint64_t BBRController::round_length() const
+{
+    if (min_rtt_ == uint64_t(-1)) {
+        return CC_UPDATE_INTERVAL_MS;
+    }
+    return max(min_rtt_, CC_UPDATE_INTERVAL_MS);
+}
+
+bool BBRController::update(const AckSample &)
+{
+    if (round_start_ == 0) {
+        round_start_ = now_;
+        min_rtt_timestamp_ = now_;
+        return false;
+    }
+
+    /* let a stale min rtt be replaced by the current one */
+    if (now_ - min_rtt_timestamp_ > BBR_MIN_RTT_WINDOW_MS) {
+        min_rtt_ = latest_rtt_;
+        min_rtt_timestamp_ = now_;
+    } else if (latest_rtt_ <= min_rtt_) {
+        min_rtt_timestamp_ = now_;
+    }
+
+    if (now_ - round_start_ < round_length()) {
+        return false;
+    }
+
+    /* one delivery rate sample per round, bottleneck bandwidth is the windowed max */
+    delivery_rate_mbps_ = delivery_rate(delivered_bytes_ - round_start_delivered_, now_ - round_start_);
+    bw_samples_.push_back(delivery_rate_mbps_);
+    if (bw_samples_.size() > BBR_BW_WINDOW_ROUNDS) {
+        bw_samples_.pop_front();
+    }
+    btl_bw_mbps_ = *max_element(bw_samples_.begin(), bw_samples_.end());
+
+    round_start_ = now_;
+    round_start_delivered_ = delivered_bytes_;
+
+    on_round_end();
+    if (btl_bw_mbps_ > 0) {
+        set_pacing_rate(pacing_gain_ * btl_bw_mbps_);
+    }
+    return true;
+}
+
+/* advance the state machine at the end of a round */
+void BBRController::on_round_end()
+{
+    switch (mode_) {
+        case STARTUP:
+            /* the pipe is full once bandwidth stops growing */
+            if (btl_bw_mbps_ >= full_bw_mbps_ * BBR_FULL_BW_GROWTH) {
+                full_bw_mbps_ = btl_bw_mbps_;
+                full_bw_rounds_ = 0;
+            } else if (++full_bw_rounds_ >= BBR_FULL_BW_ROUNDS) {
+                mode_ = DRAIN;
+                pacing_gain_ = 1.0 / BBR_STARTUP_GAIN;
+            }
+            break;
+        case DRAIN:
+            /* one round at the inverse gain empties the queue built in startup */
+            mode_ = PROBE_BW;
+            cycle_index_ = 0;
+            pacing_gain_ = BBR_PACING_GAIN_CYCLE[cycle_index_];
+            break;
+        case PROBE_BW:
+            cycle_index_ = (cycle_index_ + 1) % BBR_PACING_GAIN_CYCLE_LEN;
+            pacing_gain_ = BBR_PACING_GAIN_CYCLE[cycle_index_];
+            break;
+    }
+}
+
+string BBRController::get_algorithm_state_header() const
+{
+    return "mode, pacing_gain, delivery_rate_mbps, btl_bw_mbps";
+}
+
+string BBRController::get_algorithm_state() const
+{
+    static const char *mode_names[] = {"STARTUP", "DRAIN", "PROBE_BW"};
+    return string_format("%s, %.3f, %.3f, %.3f",
+                         mode_names[mode_],
+                         pacing_gain_,
+                         delivery_rate_mbps_,
+                         btl_bw_mbps_);
+}
+
+/* create a rate controller by name ("aimd" or "bbr"); returns nullptr for unknown names */
+unique_ptr<RateController> make_rate_controller(const string &name,
+                                                const double initial_rate_mbps,
+                                                const double max_rate_mbps)
+{
+    if (name == "aimd") {
+        return unique_ptr<RateController>(new AIMDController(initial_rate_mbps, max_rate_mbps));
+    }
+    if (name == "bbr") {
+        return unique_ptr<RateController>(new BBRController(initial_rate_mbps, max_rate_mbps));
+    }
+    return nullptr;
+}
@@ -0,0 +1,138 @@
+#ifndef UDP_CONGESTION_H
+#define UDP_CONGESTION_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+/* feedback carried by one ack (all timestamps in ms) */
+struct AckSample {
+    uint64_t sequence_number;      // data packet being acked
+    uint64_t send_timestamp;       // when we sent it **our clock**
+    uint64_t peer_recv_timestamp;  // when the peer received it **peer's clock**
+    uint64_t recv_timestamp;       // when the ack reached us **our clock**
+    uint64_t payload_length;       // payload of the acked packet
+    uint64_t lost;                 // packets declared lost since the previous sample
+};
+
+/* adjusts the pacing rate of the sender from the ack stream.
+   on_ack() runs on the receiving thread, pacing_rate_mbps() on the sending thread */
+class RateController
+{
+public:
+    RateController(double initial_rate_mbps, double max_rate_mbps);
+    virtual ~RateController() {}
+
+    /* feed one ack to this controller, an Algorithm (AIMDController or BBRController);
+       returns true when a rate decision was made. update() is bound at compile time */
+    template <typename Algorithm>
+    bool on_ack(const AckSample &ack)
+    {
+        account(ack);
+        return static_cast<Algorithm *>(this)->Algorithm::update(ack);
+    }
+
+    /* current pacing rate in Mbps */
+    double pacing_rate_mbps() const { return pacing_rate_mbps_.load(std::memory_order_relaxed); }
+
+    /* name of the algorithm */
+    virtual const char *name() const = 0;
+
+    /* csv header and row describing the controller state */
+    std::string get_state_header() const;
+    std::string get_state() const;
+
+protected:
+    /* algorithm specific reaction to an ack; returns true when a rate decision was made */
+    virtual bool update(const AckSample &ack) = 0;
+
+    /* algorithm specific state columns */
+    virtual std::string get_algorithm_state_header() const = 0;
+    virtual std::string get_algorithm_state() const = 0;
+
+    /* set pacing rate, clamped to [CC_MIN_RATE_MBPS, max_rate_mbps] */
+    void set_pacing_rate(double rate_mbps);
+
+    /* update the bookkeeping below from an ack */
+    void account(const AckSample &ack);
+
+    /* bookkeeping shared by all algorithms, updated before update() is called */
+    uint64_t now_;               // recv timestamp of the last ack
+    uint64_t latest_rtt_;        // rtt of the last ack
+    uint64_t min_rtt_;           // smallest rtt seen
+    double srtt_;                // smoothed rtt
+    uint64_t highest_acked_;     // highest data sequence number acked
+    uint64_t newly_lost_;        // packets declared lost with the last ack
+    uint64_t total_lost_;
+    uint64_t delivered_bytes_;   // payload bytes acked so far
+
+private:
+    const double max_rate_mbps_;
+    std::atomic<double> pacing_rate_mbps_;
+};
+
+/* additive increase per round trip, multiplicative decrease on loss */
+class AIMDController final : public RateController
+{
+    friend class RateController;
+
+public:
+    AIMDController(double initial_rate_mbps, double max_rate_mbps);
+    const char *name() const override { return "aimd"; }
+
+protected:
+    bool update(const AckSample &ack) override;
+    std::string get_algorithm_state_header() const override;
+    std::string get_algorithm_state() const override;
+
+private:
+    uint64_t last_increase_;
+    uint64_t last_decrease_;
+    uint64_t decreases_;
+};
+
+/* model based control in the spirit of BBR: pace at a gain times the
+   windowed max delivery rate, probing up and draining queues in turn */
+class BBRController final : public RateController
+{
+    friend class RateController;
+
+public:
+    BBRController(double initial_rate_mbps, double max_rate_mbps);
+    const char *name() const override { return "bbr"; }
+
+protected:
+    bool update(const AckSample &ack) override;
+    std::string get_algorithm_state_header() const override;
+    std::string get_algorithm_state() const override;
+
+private:
+    enum Mode { STARTUP, DRAIN, PROBE_BW };
+
+    /* length of one round in ms */
+    uint64_t round_length() const;
+
+    /* advance the state machine at the end of a round */
+    void on_round_end();
+
+    Mode mode_;
+    double pacing_gain_;
+    uint64_t cycle_index_;
+    uint64_t round_start_;
+    uint64_t round_start_delivered_;
+    uint64_t min_rtt_timestamp_;
+    double delivery_rate_mbps_;
+    double btl_bw_mbps_;
+    std::deque<double> bw_samples_;
+    double full_bw_mbps_;
+    uint64_t full_bw_rounds_;
+};
+
+/* create a rate controller by name ("aimd" or "bbr"); returns nullptr for unknown names */
+std::unique_ptr<RateController> make_rate_controller(const std::string &name,
+                                                     double initial_rate_mbps,
+                                                     double max_rate_mbps);
+
+#endif //UDP_CONGESTION_H
@@ -0,0 +1,386 @@
+#include "control.h"
+#include "config.h"
+#include "timestamp.h"
+#include "utils.h"
+#include "packet.h"
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+using namespace std;
+
+/* length of a control message on the wire, without and with the warm-up length */
+static const size_t CONTROL_MESSAGE_LEN = 52;
+static const size_t CONTROL_WARMUP_MESSAGE_LEN = CONTROL_MESSAGE_LEN + sizeof(uint32_t);
+
+/* rate controllers by wire id */
+static const char *CC_NAMES[] = {"", "aimd", "bbr"};
+static const uint8_t CC_COUNT = sizeof(CC_NAMES) / sizeof(CC_NAMES[0]);
+
+/* helpers to put fields in network byte order */
+static void put_u8(string &out, const uint8_t n) { out.push_back(char(n)); }
+static void put_u16(string &out, const uint16_t n)
+{
+    const uint16_t network_order = htobe16(n);
+    out.append(reinterpret_cast<const char*>(&network_order), sizeof(network_order));
+}
+static void put_u32(string &out, const uint32_t n)
+{
+    const uint32_t network_order = htobe32(n);
+    out.append(reinterpret_cast<const char*>(&network_order), sizeof(network_order));
+}
+static void put_u64(string &out, const uint64_t n)
+{
+    const uint64_t network_order = htobe64(n);
+    out.append(reinterpret_cast<const char*>(&network_order), sizeof(network_order));
+}
+static void put_double(string &out, const double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    put_u64(out, bits);
+}
+
+/* helpers to get fields in network byte order, advancing pos */
+template <typename T> static T get_field(const string &str, size_t &pos)
+{
+    if (str.size() < pos + sizeof(T)) {
+        throw runtime_error("control message too small");
+    }
+    T n;
+    memcpy(&n, str.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return n;
+}
+static uint8_t get_u8(const string &str, size_t &pos) { return get_field<uint8_t>(str, pos); }
+static uint16_t get_u16(const string &str, size_t &pos) { return be16toh(get_field<uint16_t>(str, pos)); }
+static uint32_t get_u32(const string &str, size_t &pos) { return be32toh(get_field<uint32_t>(str, pos)); }
+static uint64_t get_u64(const string &str, size_t &pos) { return be64toh(get_field<uint64_t>(str, pos)); }
+static double get_double(const string &str, size_t &pos)
+{
+    const uint64_t bits = get_u64(str, pos);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static uint8_t cc_id(const string &name)
+{
+    for (uint8_t id = 0; id < CC_COUNT; id++) {
+        if (name == CC_NAMES[id]) {
+            return id;
+        }
+    }
+    return 0;
+}
+
+/* random session id, never 0 */
+static uint64_t new_session_id()
+{
+    random_device device;
+    mt19937_64 generator((uint64_t(device()) << 32) ^ device() ^
+                         chrono::high_resolution_clock::now().time_since_epoch().count());
+    uint64_t id = 0;
+    while (id == 0) {
+        id = generator();
+    }
+    return id;
+}
+
+/* Make human-readable representation of session parameters */
+string SessionParams::get_string() const
+{
+    const string warmup = warmup_ms > 0 ? string_format(", warm-up %u ms", warmup_ms) : "";
+    return string_format("session %016lx: %s, %.3f Mbps, %u s, payload %u bytes, cc %s (max %.3f Mbps), ack every %u pkts / %u us, %u streams%s",
+                         session_id,
+                         downlink ? "Server -> Client" : "Client -> Server",
+                         rate_mbps,
+                         duration_s,
+                         payload_len,
+                         cc_algorithm.empty() ? "off" : cc_algorithm.c_str(),
+                         max_rate_mbps,
+                         ack_every,
+                         ack_interval_us,
+                         streams,
+                         warmup.c_str());
+}
+
+/* New message */
+ControlMessage::ControlMessage(const uint8_t s_type, const SessionParams &s_params)
+    : version(CONTROL_VERSION), type(s_type), params(s_params)
+{}
+
+/* Parse message from wire */
+ControlMessage::ControlMessage(const string &str)
+    : version(0), type(0), params()
+{
+    if (not is_control_message(str)) {
+        throw runtime_error("not a control message");
+    }
+    size_t pos = sizeof(CONTROL_MAGIC);
+    version = get_u8(str, pos);
+    type = get_u8(str, pos);
+    params.capabilities = get_u16(str, pos);
+    params.session_id = get_u64(str, pos);
+    params.rate_mbps = get_double(str, pos);
+    params.duration_s = get_u32(str, pos);
+    params.payload_len = get_u32(str, pos);
+    params.downlink = get_u8(str, pos) == 0;
+    const uint8_t cc = get_u8(str, pos);
+    params.cc_algorithm = cc < CC_COUNT ? CC_NAMES[cc] : "";
+    params.streams = std::max(uint16_t(1), get_u16(str, pos));  // 0 from peers that predate streams
+    params.ack_every = get_u32(str, pos);
+    params.ack_interval_us = get_u32(str, pos);
+    params.max_rate_mbps = get_double(str, pos);
+    params.warmup_ms = str.size() == CONTROL_WARMUP_MESSAGE_LEN ? get_u32(str, pos) : 0;
+}
+
+/* Make wire representation of message */
+string ControlMessage::to_string() const
+{
+    string out;
+    out.reserve(CONTROL_WARMUP_MESSAGE_LEN);
+    put_u32(out, CONTROL_MAGIC);
+    put_u8(out, version);
+    put_u8(out, type);
+    put_u16(out, params.capabilities);
+    put_u64(out, params.session_id);
+    put_double(out, params.rate_mbps);
+    put_u32(out, params.duration_s);
+    put_u32(out, params.payload_len);
+    put_u8(out, params.downlink ? 0 : 1);
+    put_u8(out, cc_id(params.cc_algorithm));
+    put_u16(out, params.streams);
+    put_u32(out, params.ack_every);
+    put_u32(out, params.ack_interval_us);
+    put_double(out, params.max_rate_mbps);
+    if (params.warmup_ms > 0) {
+        put_u32(out, params.warmup_ms);
+    }
+    return out;
+}
+
+/* Is this datagram a control message? */
+bool is_control_message(const string &payload)
+{
+    if (payload.size() != CONTROL_MESSAGE_LEN and payload.size() != CONTROL_WARMUP_MESSAGE_LEN) {
+        return false;
+    }
+    size_t pos = 0;
+    return get_u32(payload, pos) == CONTROL_MAGIC;
+}
+
+static void send_control(const int fd, const struct sockaddr_in6 &peer, const uint8_t type, const SessionParams &params)
+{
+    const string message = ControlMessage(type, params).to_string();
+    sendto(fd, message.data(), message.size(), 0, (const struct sockaddr *) &peer, sizeof(peer));
+}
+
+static bool same_address(const struct sockaddr_in6 &a, const struct sockaddr_in6 &b)
+{
+    return a.sin6_family == b.sin6_family and a.sin6_port == b.sin6_port and same_host(a, b);
+}
+
+/* receive one datagram (or peek at it) with its source address */
+static string receive_from(const int fd, struct sockaddr_in6 &from, const int flags = 0)
+{
+    static char buffer[RECV_BUFFER_LEN];
+    socklen_t from_len = sizeof(from);
+    const ssize_t len = recvfrom(fd, buffer, sizeof(buffer), flags, (struct sockaddr *) &from, &from_len);
+    if (len < 0) {
+        if (errno == EINTR or errno == EAGAIN or errno == ECONNREFUSED) {
+            return "";  // ECONNREFUSED: icmp error left over from an earlier session's client
+        }
+        throw unix_error("recvfrom");
+    }
+    return string(buffer, len);
+}
+
+/* client side: agree on a session with the server at peer, retransmitting HELLO
+   until the server answers; returns the parameters accepted by the server */
+SessionParams client_handshake(const int fd, const struct sockaddr_in6 &peer, SessionParams requested)
+{
+    requested.session_id = new_session_id();
+    requested.capabilities = LOCAL_CAPABILITIES;
+
+    for (uint64_t attempt = 0; attempt < CONTROL_RETRIES; attempt++) {
+        send_control(fd, peer, CONTROL_HELLO, requested);
+
+        const uint64_t deadline_us = timestamp_us() + CONTROL_RETRY_MS * 1000;
+        for (uint64_t now_us = timestamp_us(); now_us < deadline_us; now_us = timestamp_us()) {
+            if (not wait_readable(fd, deadline_us - now_us)) {
+                break;
+            }
+            struct sockaddr_in6 from{};
+            const string payload = receive_from(fd, from);
+            if (not same_address(from, peer) or not is_control_message(payload)) {
+                continue;
+            }
+            const ControlMessage reply(payload);
+            if (reply.params.session_id != requested.session_id) {
+                continue;
+            }
+            if (reply.type == CONTROL_REJECT) {
+                Error("Server rejected the session (server protocol version %d)", reply.version);
+            }
+            if (reply.type == CONTROL_HELLO_ACK) {
+                send_control(fd, peer, CONTROL_START, reply.params);
+                return reply.params;
+            }
+        }
+    }
+    Error("No answer from the server after %lu attempts", CONTROL_RETRIES);
+    return requested;
+}
+
+/* client side: answer a HELLO_ACK retransmitted by the server after the handshake
+   (our START got lost); other control messages are ignored */
+void client_on_late_control(const int fd, const struct sockaddr_in6 &peer, const string &payload, const SessionParams &session)
+{
+    const ControlMessage message(payload);
+    if (message.type == CONTROL_HELLO_ACK and message.params.session_id == session.session_id) {
+        send_control(fd, peer, CONTROL_START, session);
+    }
+}
+
+/* server side: bound what a client may ask for to what this server carries */
+SessionParams bound_session_params(SessionParams params)
+{
+    params.capabilities &= LOCAL_CAPABILITIES;
+    params.payload_len = std::max(uint32_t(1), std::min(params.payload_len, uint32_t(MAX_PAYLOAD_LEN)));
+    if (not (params.capabilities & CAP_ACK_BLOCKS)) {
+        params.ack_every = 1;
+        params.ack_interval_us = 0;
+    }
+    params.ack_every = std::max(uint32_t(1), std::min(params.ack_every, uint32_t(ACK_BLOCK_MAX_PACKETS)));
+    params.ack_interval_us = std::min(params.ack_interval_us, uint32_t(ACK_INTERVAL_MAX_US));
+    params.streams = std::max(uint16_t(1), std::min(params.streams, uint16_t(MAX_STREAMS)));
+    params.warmup_ms = std::min(params.warmup_ms, uint32_t(MAX_WARMUP_MS));
+
+    /* the client picks rate and length, within what the server is willing to carry;
+       a zero, negative or NaN rate would leave the pacing without packets per ms */
+    if (not (params.rate_mbps >= CC_MIN_RATE_MBPS)) {
+        params.rate_mbps = CC_MIN_RATE_MBPS;
+    }
+    params.rate_mbps = std::min(params.rate_mbps, MAX_SESSION_RATE_MBPS);
+    if (not (params.max_rate_mbps > 0.0 and params.max_rate_mbps <= MAX_SESSION_RATE_MBPS)) {
+        params.max_rate_mbps = MAX_SESSION_RATE_MBPS;
+    }
+    params.duration_s = std::min(params.duration_s, MAX_SESSION_DURATION_S);
+    if (not (params.capabilities & CAP_RATE_CONTROL)) {
+        params.cc_algorithm = "";
+    }
+    return params;
+}
+
+/* server side: the parameters accepted for a client at peer */
+static SessionParams accept_params(const SessionParams &requested, const struct sockaddr_in6 &peer)
+{
+    SessionParams params = bound_session_params(requested);
+
+    /* data packets must not be fragmented on the way to the client either */
+    const uint32_t path_payload_len = path_max_payload_len(peer);
+    if (params.payload_len > path_payload_len) {
+        Log("payload %u does not fit the path MTU to the client; using %u", params.payload_len, path_payload_len);
+        params.payload_len = path_payload_len;
+    }
+    return params;
+}
+
+/* server side: retransmit HELLO_ACK until the client confirms with START or starts sending data */
+static bool wait_for_start(const int fd, const struct sockaddr_in6 &peer, const SessionParams &accepted)
+{
+    for (uint64_t attempt = 0; attempt < CONTROL_RETRIES; attempt++) {
+        send_control(fd, peer, CONTROL_HELLO_ACK, accepted);
+
+        const uint64_t deadline_us = timestamp_us() + CONTROL_RETRY_MS * 1000;
+        for (uint64_t now_us = timestamp_us(); now_us < deadline_us; now_us = timestamp_us()) {
+            if (not wait_readable(fd, deadline_us - now_us)) {
+                break;
+            }
+            /* peek, so that a data packet standing in for START stays queued for the run. Only
+               uplink data can: the client must prove its address before the server sends to it */
+            struct sockaddr_in6 from{};
+            const string payload = receive_from(fd, from, MSG_PEEK);
+            if (not accepted.downlink and same_address(from, peer) and not payload.empty() and
+                not is_control_message(payload)) {
+                return true;
+            }
+            receive_from(fd, from);
+            if (not is_control_message(payload)) {
+                continue;
+            }
+            const ControlMessage message(payload);
+            if (not same_address(from, peer)) {
+                if (message.type == CONTROL_HELLO) {
+                    send_control(fd, from, CONTROL_REJECT, message.params);  // busy
+                }
+                continue;
+            }
+            if (message.params.session_id != accepted.session_id) {
+                continue;
+            }
+            if (message.type == CONTROL_START) {
+                return true;
+            }
+            if (message.type == CONTROL_HELLO) {
+                send_control(fd, peer, CONTROL_HELLO_ACK, accepted);
+            }
+        }
+    }
+    return false;
+}
+
+/* server side: the old string handshake, for clients that predate the control messages */
+static bool legacy_handshake(const int fd, const struct sockaddr_in6 &peer)
+{
+    sendto(fd, "Test1_ACK\n", strlen("Test1_ACK\n"), 0, (const struct sockaddr *) &peer, sizeof(peer));
+    sendto(fd, "Test2_ACK\n", strlen("Test2_ACK\n"), 0, (const struct sockaddr *) &peer, sizeof(peer));
+    if (not wait_readable(fd, CONTROL_RETRIES * CONTROL_RETRY_MS * 1000)) {
+        return false;
+    }
+    struct sockaddr_in6 from{};
+    receive_from(fd, from);
+    return true;
+}
+
+/* server side: wait for a client and agree on a session. legacy, if not null,
+   holds the parameters used for clients of the old "Test1" string handshake.
+   Fills in the client address and returns the session parameters */
+SessionParams server_handshake(const int fd, struct sockaddr_in6 &peer, const SessionParams *legacy)
+{
+    while (true) {
+        const string payload = receive_from(fd, peer);
+
+        if (payload.compare(0, strlen("Test1"), "Test1") == 0) {
+            if (not legacy) {
+                Log("Ignoring a client of the old handshake: no SENDING_RATE DURATION DOWN/UP given");
+            } else if (legacy_handshake(fd, peer)) {
+                return *legacy;
+            }
+            continue;
+        }
+
+        /* anything else but a HELLO is a leftover of an earlier session */
+        if (not is_control_message(payload)) {
+            continue;
+        }
+        const ControlMessage hello(payload);
+        if (hello.type != CONTROL_HELLO) {
+            continue;
+        }
+        if (hello.version != CONTROL_VERSION) {
+            Log("Rejecting a client of control protocol version %d", hello.version);
+            send_control(fd, peer, CONTROL_REJECT, hello.params);
+            continue;
+        }
+
+        const SessionParams accepted = accept_params(hello.params, peer);
+        if (wait_for_start(fd, peer, accepted)) {
+            return accepted;
+        }
+        Log("Session %016lx abandoned: no START from the client", accepted.session_id);
+    }
+}
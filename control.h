@@ -0,0 +1,98 @@
+#ifndef UDP_CONTROL_H
+#define UDP_CONTROL_H
+
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Session handshake. The client proposes the run parameters, the server
+   accepts (possibly adjusting them) and the client confirms:
+
+       client                       server
+       HELLO(session, params)  -->
+                               <--  HELLO_ACK(session, params)
+       START(session)          -->
+       data ...
+
+   HELLO and HELLO_ACK are retransmitted until answered. A lost START is
+   recovered by the server retransmitting HELLO_ACK (downlink) or by the first
+   data packet (uplink). Control messages start with CONTROL_MAGIC where data
+   packets carry the upper half of their sequence number, so both can share
+   the socket. A warm-up length, when asked for, trails the parameters; peers
+   that predate it only ever see messages without one. */
+
+const uint32_t CONTROL_MAGIC = 0x55445043; // "UDPC"
+const uint8_t CONTROL_VERSION = 1;
+
+enum ControlType : uint8_t {
+    CONTROL_HELLO = 1,
+    CONTROL_HELLO_ACK = 2,
+    CONTROL_START = 3,
+    CONTROL_REJECT = 4,
+};
+
+/* features a peer supports */
+enum Capability : uint16_t {
+    CAP_ACK_BLOCKS = 1 << 0,    // decodes / sends aggregated acks
+    CAP_RATE_CONTROL = 1 << 1,  // closed-loop sending
+    CAP_CLOCK_SYNC = 1 << 2,    // answers clock probes
+};
+const uint16_t LOCAL_CAPABILITIES = CAP_ACK_BLOCKS | CAP_RATE_CONTROL | CAP_CLOCK_SYNC;
+
+/* run parameters agreed on by the handshake */
+struct SessionParams {
+    uint64_t session_id;
+    uint16_t capabilities;
+    double rate_mbps;
+    uint32_t duration_s;
+    bool downlink;               // server -> client
+    uint32_t payload_len;
+    std::string cc_algorithm;    // rate controller of the sending side ("" = fixed rate)
+    double max_rate_mbps;
+    uint32_t ack_every;          // ack aggregation on the receiving side
+    uint32_t ack_interval_us;
+    uint16_t streams;            // sockets / threads the data is spread over
+    uint32_t warmup_ms;          // unlogged warm-up before the measured interval (0 = none)
+
+    /* Make human-readable representation */
+    std::string get_string() const;
+};
+
+struct ControlMessage
+{
+    uint8_t version;
+    uint8_t type;
+    SessionParams params;
+
+    /* New message */
+    ControlMessage(uint8_t s_type, const SessionParams &s_params);
+
+    /* Parse message from wire */
+    explicit ControlMessage(const std::string &str);
+
+    /* Make wire representation of message */
+    std::string to_string() const;
+};
+
+/* Is this datagram a control message? */
+bool is_control_message(const std::string &payload);
+
+/* client side: agree on a session with the server at peer, retransmitting HELLO
+   until the server answers; returns the parameters accepted by the server */
+SessionParams client_handshake(int fd, const struct sockaddr_in6 &peer, SessionParams requested);
+
+/* client side: answer a HELLO_ACK retransmitted by the server after the handshake
+   (our START got lost); other control messages are ignored */
+void client_on_late_control(int fd, const struct sockaddr_in6 &peer, const std::string &payload, const SessionParams &session);
+
+/* server side: bound what a client may ask for to what this server carries
+   (capabilities, payload, ack aggregation, streams, warm-up, rate and duration) */
+SessionParams bound_session_params(SessionParams params);
+
+/* server side: wait for a client and agree on a session. legacy, if not null,
+   holds the parameters used for clients of the old "Test1" string handshake.
+   Fills in the client address and returns the session parameters */
+SessionParams server_handshake(int fd, struct sockaddr_in6 &peer, const SessionParams *legacy);
+
+#endif //UDP_CONTROL_H
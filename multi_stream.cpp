@@ -0,0 +1,211 @@
+#include "multi_stream.h"
+#include "config.h"
+#include "options.h"
+#include "packet.h"
+#include "timestamp.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+/* start and tune one thread per stream; stream i is pinned to cpu
+   first_cpu + i (modulo the cpu count) unless first_cpu is -1 */
+StreamSenders::StreamSenders(const uint64_t streams, const int first_cpu, const int rt_priority)
+    : roles_(),
+    threads_(),
+    streams_(),
+    flow_(NULL),
+    next_sequence_number_(1)
+{
+    const long cpus = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    for (uint64_t i = 0; i < streams; i++) {
+        roles_.push_back(string_format("send-%lu", i));
+    }
+    for (uint64_t i = 0; i < streams; i++) {
+        const int cpu = first_cpu < 0 ? -1 : int((first_cpu + i) % cpus);
+        threads_.emplace_back(new TunedThread(roles_[i].c_str(), cpu, rt_priority));
+    }
+}
+
+/* description of the settings the threads run with */
+vector<string> StreamSenders::effective() const
+{
+    vector<string> settings;
+    for (const unique_ptr<TunedThread> &thread : threads_) {
+        settings.push_back(thread->effective());
+    }
+    return settings;
+}
+
+/* send the flow over fresh sockets, one per stream, and return when every
+   stream is done and the end-of-run packets are sent */
+void StreamSenders::run(const StreamFlow &flow)
+{
+    flow_ = &flow;
+    next_sequence_number_ = 1;
+
+    /* each stream connects its own socket, so the kernel picks a distinct source port */
+    streams_.assign(threads_.size(), Stream());
+    for (uint64_t i = 0; i < threads_.size(); i++) {
+        const int fd = dual_stack_udp_socket();
+        if (fd < 0) {
+            Error("Cannot create socket for stream %lu!!!", i);
+        }
+        set_path_mtu_discovery(fd);
+        if (run_options.sndbuf_bytes > 0) {
+            set_socket_buffers(fd, 0, run_options.sndbuf_bytes, run_options.force_buffers);
+        }
+        connect_socket_to_address(fd, (const struct sockaddr *) &flow.peer, sizeof(flow.peer));
+        streams_[i] = {this, i, fd};
+    }
+
+    for (uint64_t i = 0; i < threads_.size(); i++) {
+        threads_[i]->run(send_stream, &streams_[i]);
+    }
+    for (uint64_t i = 0; i < threads_.size(); i++) {
+        threads_[i]->wait();
+        close(streams_[i].fd);
+    }
+
+    /* end of run, from the main socket; send a few times just in case */
+    const string message = create_packet(0, flow.payload_len);
+    for (int i = 0; i < 5; i++) {
+        send_packet(flow.main_fd, (struct sockaddr *) &flow.peer, sizeof(flow.peer), message);
+    }
+    *flow.running = false;
+}
+
+/* thread entry for send_stream_packets; an error ends the flow of every stream */
+void *StreamSenders::send_stream(void *stream_ptr)
+{
+    const Stream &stream = *static_cast<Stream*>(stream_ptr);
+    try {
+        send_stream_packets(stream);
+    } catch (const exception &e) {
+        Log("%s: %s (ending the session)", stream.senders->roles_[stream.index].c_str(), e.what());
+        *stream.senders->flow_->running = false;
+    }
+    return NULL;
+}
+
+/* pace one stream at its share of the flow rate */
+void StreamSenders::send_stream_packets(const Stream &stream)
+{
+    StreamSenders &senders = *stream.senders;
+    const StreamFlow &flow = *senders.flow_;
+    const double share = 1.0 / senders.threads_.size();
+
+    uint64_t sequence_number = 0, block_end = 0;
+    double credit = 0.0;
+    const uint64_t start_time_ms = timestamp_ms();
+    uint64_t last_tick_ms = start_time_ms;
+
+    /* past the duration, finish the current block so the receiver sees no gap */
+    while (*flow.running) {
+        const uint64_t now_ms = timestamp_ms();
+        const bool in_time = (now_ms - start_time_ms) <= flow.duration_ms;
+        if (not in_time and sequence_number == block_end) {
+            break;
+        }
+        const double rate_mbps = flow.rate_controller ? flow.rate_controller->pacing_rate_mbps() : flow.rate_mbps;
+        const double pkts_per_ms = rate_mbps * share * sending_rate_const(flow.payload_len);
+        credit = min(credit + pkts_per_ms * (now_ms - last_tick_ms), max(1.0, pkts_per_ms * CC_MAX_BURST_MS));
+        last_tick_ms = now_ms;
+        while (credit >= 1.0) {
+            if (sequence_number == block_end) {
+                if (not in_time) {
+                    break;
+                }
+                sequence_number = senders.next_sequence_number_.fetch_add(STREAM_SEQ_BLOCK);
+                block_end = sequence_number + STREAM_SEQ_BLOCK;
+            }
+            const bool traced = flow.stage_trace and flow.stage_trace->sampled(sequence_number);
+            if (traced) {
+                flow.stage_trace->record(sequence_number, STAGE_GENERATE, realtime_ns());
+            }
+            const string message = create_packet(sequence_number, flow.payload_len);
+            flow.send_history->on_send(sequence_number, timestamp_us());
+            if (traced) {
+                flow.stage_trace->record(sequence_number, STAGE_SEND, realtime_ns());
+            }
+            const bool sent = send_packet(stream.fd, (struct sockaddr *) &flow.peer, sizeof(flow.peer), message);
+            if (traced) {
+                flow.stage_trace->record(sequence_number, STAGE_SENT, realtime_ns());
+            }
+            if (not sent) {
+                flow.send_history->forget(sequence_number);
+            }
+            sequence_number++;
+            credit -= 1.0;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+/* reordering the sender must tolerate before declaring a packet lost */
+uint64_t stream_reorder_threshold(const uint64_t streams)
+{
+    /* streams send from blocks that are up to one block per stream apart */
+    return streams > 1 ? streams * STREAM_SEQ_BLOCK : LOSS_REORDER_THRESHOLD;
+}
+
+StreamReassembly::StreamReassembly()
+    : window_(REASSEMBLY_WINDOW, 0),
+    per_stream_(),
+    highest_(0),
+    received_(0),
+    duplicates_(0),
+    reordered_(0),
+    max_reorder_distance_(0)
+{}
+
+/* forget everything, before a new session */
+void StreamReassembly::reset()
+{
+    *this = StreamReassembly();
+}
+
+/* account for a data packet that arrived from source_port */
+void StreamReassembly::on_packet(const uint64_t sequence_number, const uint16_t source_port)
+{
+    received_++;
+    per_stream_[source_port]++;
+
+    uint64_t &slot = window_[sequence_number % REASSEMBLY_WINDOW];
+    if (slot == sequence_number) {
+        duplicates_++;
+        return;
+    }
+    slot = sequence_number;
+
+    if (sequence_number < highest_) {
+        reordered_++;
+        max_reorder_distance_ = max(max_reorder_distance_, highest_ - sequence_number);
+    } else {
+        highest_ = sequence_number;
+    }
+}
+
+/* human-readable summary */
+string StreamReassembly::get_string() const
+{
+    const uint64_t unique = received_ - duplicates_;
+    string per_stream;
+    for (const pair<const uint16_t, uint64_t> &stream : per_stream_) {
+        per_stream += string_format("%s%u:%lu", per_stream.empty() ? "" : " ", stream.first, stream.second);
+    }
+    return string_format("reassembly: %lu streams; received %lu; lost %lu (highest %lu); reordered %lu (max distance %lu); "
+                         "duplicates %lu; per source port %s",
+                         per_stream_.size(),
+                         received_,
+                         highest_ > unique ? highest_ - unique : 0,
+                         highest_,
+                         reordered_,
+                         max_reorder_distance_,
+                         duplicates_,
+                         per_stream.c_str());
+}
@@ -0,0 +1,97 @@
+#ifndef UDP_MULTI_STREAM_H
+#define UDP_MULTI_STREAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+#include "congestion.h"
+#include "send_history.h"
+#include "stage_trace.h"
+#include "tuning.h"
+
+/* Multi-stream sending. One logical flow is spread over K sending threads,
+   each with its own connected socket (so its own source port) and 1/K of the
+   target rate. Sequence numbers stay global: threads take them from a shared
+   counter STREAM_SEQ_BLOCK at a time and finish a block before they stop, so
+   the receiver sees one sequence space with gaps only for lost packets. Acks
+   of all streams go to the main socket of the sending side. */
+
+/* the flow to send, shared by all streams */
+struct StreamFlow {
+    int main_fd;                       // main socket, sends the end-of-run packets
+    struct sockaddr_in6 peer;
+    uint64_t duration_ms;
+    uint64_t payload_len;
+    double rate_mbps;                  // target rate of the whole flow, without a controller
+    RateController *rate_controller;   // closed-loop rate of the whole flow (may be null)
+    SendHistory *send_history;
+    StageTrace *stage_trace;           // per-packet stage timestamps (may be null)
+    std::atomic<bool> *running;        // cleared when the flow is done or must stop
+};
+
+class StreamSenders
+{
+public:
+    /* start and tune one thread per stream; stream i is pinned to cpu
+       first_cpu + i (modulo the cpu count) unless first_cpu is -1 */
+    StreamSenders(uint64_t streams, int first_cpu, int rt_priority);
+
+    /* description of the settings the threads run with */
+    std::vector<std::string> effective() const;
+
+    /* send the flow over fresh sockets, one per stream, and return when every
+       stream is done and the end-of-run packets are sent */
+    void run(const StreamFlow &flow);
+
+private:
+    struct Stream {
+        StreamSenders *senders;
+        uint64_t index;
+        int fd;
+    };
+
+    static void *send_stream(void *stream_ptr);
+    static void send_stream_packets(const Stream &stream);
+
+    std::vector<std::string> roles_;
+    std::vector<std::unique_ptr<TunedThread>> threads_;
+    std::vector<Stream> streams_;
+    const StreamFlow *flow_;
+    std::atomic<uint64_t> next_sequence_number_;
+};
+
+/* reordering the sender must tolerate before declaring a packet lost */
+uint64_t stream_reorder_threshold(uint64_t streams);
+
+/* Receiving side: merges the streams of a flow back into one sequence space
+   and accounts for loss, duplicates and reordering */
+class StreamReassembly
+{
+public:
+    StreamReassembly();
+
+    /* forget everything, before a new session */
+    void reset();
+
+    /* account for a data packet that arrived from source_port */
+    void on_packet(uint64_t sequence_number, uint16_t source_port);
+
+    /* human-readable summary */
+    std::string get_string() const;
+
+private:
+    std::vector<uint64_t> window_;       // sequence number last seen in slot seq % REASSEMBLY_WINDOW
+    std::map<uint16_t, uint64_t> per_stream_;
+    uint64_t highest_;
+    uint64_t received_;
+    uint64_t duplicates_;
+    uint64_t reordered_;
+    uint64_t max_reorder_distance_;
+};
+
+#endif //UDP_MULTI_STREAM_H
@@ -0,0 +1,70 @@
+#!/bin/bash
+
+###########################################################
+## Run multiple persistent (daemon) netmashup servers    ##
+###########################################################
+
+if [[ "$#" -ne 2 ]];
+then
+    echo "Usage: $0 NUM_SERVERS RUN_NUMBER"
+    exit 1
+fi
+
+# Assumes the port numbers used by the servers start at 5201
+# and increase e.g. 5201, 5202, 5203, ...
+base_port=5200
+
+# Command line input: number of servers e.g. 5
+num_servers=$1
+shift
+
+# Command line input: run_number for this experiment
+run_number=$1
+shift
+
+## move to script directory
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+echo "Script Dir: $SCRIPT_DIR"
+
+# Daemons stay up between runs: only start the ones that are not running.
+# The clients choose rate, duration and direction of every session.
+# A daemon keeps the log file name it was started with, so one that is
+# running for another RUN_NUMBER is refused: stop it first with
+# netmashup-stop-parallel-servers.sh.
+refused=0
+for i in `seq 1 $num_servers`; do
+
+    printf "\n"
+
+	# Set server port
+	server_port=$(($base_port+$i));
+
+    # log filename includes server port and run_number; each session adds its number
+    logfile="$SCRIPT_DIR/logs/$run_number-$server_port.csv"
+
+    pid=$(lsof -t -i:${server_port} | head -n 1)
+    if [ -n "$pid" ]
+    then
+        running_logfile=$(tr '\0' '\n' < /proc/$pid/cmdline | sed -n 3p)
+        if [ "$running_logfile" == "$logfile" ]
+        then
+            echo "Server already running on port: $server_port"
+        else
+            echo "Server on port $server_port logs to $running_logfile, not $logfile: stop it first"
+            refused=1
+        fi
+        continue
+    fi
+
+	# Run netmashup
+    echo "starting daemon server on port: $server_port"
+	${SCRIPT_DIR}/bin/custom_udp_server ${server_port} ${logfile} --daemon > /dev/null 2>&1 &
+
+done
+
+if [ "$refused" -ne 0 ]
+then
+    printf "\nSome servers run for another RUN_NUMBER... \n"
+    exit 1
+fi
+printf "\nAll servers are running... \n"
@@ -0,0 +1,205 @@
+#include "options.h"
+#include "utils.h"
+#include "config.h"
+
+#include <cstdlib>
+#include <getopt.h>
+
+using namespace std;
+
+RunOptions run_options;
+
+enum option_ids {
+    OPT_CC = 256,
+    OPT_MAX_RATE,
+    OPT_PAYLOAD,
+    OPT_ACK_EVERY,
+    OPT_ACK_INTERVAL,
+    OPT_SEND_CPU,
+    OPT_RECV_CPU,
+    OPT_RT_PRIORITY,
+    OPT_BUSY_POLL,
+    OPT_SPIN,
+    OPT_RCVBUF,
+    OPT_SNDBUF,
+    OPT_FORCE_BUFFERS,
+    OPT_DAEMON,
+    OPT_STREAMS,
+    OPT_XDP,
+    OPT_XDP_QUEUE,
+    OPT_XDP_NATIVE,
+    OPT_USER_TIMESTAMPS,
+    OPT_DEBUG,
+    OPT_WARMUP,
+    OPT_MLOCK,
+    OPT_TRACE_STAGES,
+};
+
+static const struct option long_options[] = {
+    {"cc",           required_argument, NULL, OPT_CC},
+    {"max-rate",     required_argument, NULL, OPT_MAX_RATE},
+    {"payload",      required_argument, NULL, OPT_PAYLOAD},
+    {"ack-every",    required_argument, NULL, OPT_ACK_EVERY},
+    {"ack-interval", required_argument, NULL, OPT_ACK_INTERVAL},
+    {"send-cpu",     required_argument, NULL, OPT_SEND_CPU},
+    {"recv-cpu",     required_argument, NULL, OPT_RECV_CPU},
+    {"rt-priority",  required_argument, NULL, OPT_RT_PRIORITY},
+    {"busy-poll",    required_argument, NULL, OPT_BUSY_POLL},
+    {"spin",         no_argument,       NULL, OPT_SPIN},
+    {"rcvbuf",       required_argument, NULL, OPT_RCVBUF},
+    {"sndbuf",       required_argument, NULL, OPT_SNDBUF},
+    {"force-buffers", no_argument,      NULL, OPT_FORCE_BUFFERS},
+    {"daemon",       no_argument,       NULL, OPT_DAEMON},
+    {"streams",      required_argument, NULL, OPT_STREAMS},
+    {"xdp",          required_argument, NULL, OPT_XDP},
+    {"xdp-queue",    required_argument, NULL, OPT_XDP_QUEUE},
+    {"xdp-native",   no_argument,       NULL, OPT_XDP_NATIVE},
+    {"user-timestamps", no_argument,    NULL, OPT_USER_TIMESTAMPS},
+    {"debug",        no_argument,       NULL, OPT_DEBUG},
+    {"warmup",       required_argument, NULL, OPT_WARMUP},
+    {"mlock",        no_argument,       NULL, OPT_MLOCK},
+    {"trace-stages", required_argument, NULL, OPT_TRACE_STAGES},
+    {NULL, 0, NULL, 0}
+};
+
+/* parse --long options into run_options; positional arguments are left at argv[optind..] */
+bool parse_run_options(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case OPT_CC:
+                run_options.cc_algorithm = optarg;
+                if (run_options.cc_algorithm != "aimd" and run_options.cc_algorithm != "bbr") {
+                    Log("Unknown rate controller: %s", optarg);
+                    return false;
+                }
+                break;
+            case OPT_MAX_RATE:
+                run_options.max_rate_mbps = atof(optarg);
+                break;
+            case OPT_PAYLOAD:
+                if (strcmp(optarg, "mtu") == 0) {
+                    run_options.payload_fill_mtu = true;
+                    break;
+                }
+                run_options.payload_len = strtoull(optarg, NULL, 10);
+                if (run_options.payload_len < 1 or run_options.payload_len > MAX_PAYLOAD_LEN) {
+                    Log("--payload must be between 1 and %lu", MAX_PAYLOAD_LEN);
+                    return false;
+                }
+                break;
+            case OPT_ACK_EVERY:
+                run_options.ack_every = strtoull(optarg, NULL, 10);
+                if (run_options.ack_every < 1 or run_options.ack_every > ACK_BLOCK_MAX_PACKETS) {
+                    Log("--ack-every must be between 1 and %lu", ACK_BLOCK_MAX_PACKETS);
+                    return false;
+                }
+                break;
+            case OPT_ACK_INTERVAL:
+                run_options.ack_interval_us = strtoull(optarg, NULL, 10);
+                if (run_options.ack_interval_us > ACK_INTERVAL_MAX_US) {
+                    Log("--ack-interval must be at most %lu", ACK_INTERVAL_MAX_US);
+                    return false;
+                }
+                break;
+            case OPT_SEND_CPU:
+                run_options.send_cpu = atoi(optarg);
+                break;
+            case OPT_RECV_CPU:
+                run_options.recv_cpu = atoi(optarg);
+                break;
+            case OPT_RT_PRIORITY:
+                run_options.rt_priority = atoi(optarg);
+                break;
+            case OPT_BUSY_POLL:
+                run_options.busy_poll_us = atoi(optarg);
+                break;
+            case OPT_SPIN:
+                run_options.spin_poll = true;
+                break;
+            case OPT_RCVBUF:
+                run_options.rcvbuf_bytes = atoi(optarg);
+                break;
+            case OPT_SNDBUF:
+                run_options.sndbuf_bytes = atoi(optarg);
+                break;
+            case OPT_FORCE_BUFFERS:
+                run_options.force_buffers = true;
+                break;
+            case OPT_DAEMON:
+                run_options.daemon = true;
+                break;
+            case OPT_STREAMS:
+                run_options.streams = strtoull(optarg, NULL, 10);
+                if (run_options.streams < 1 or run_options.streams > MAX_STREAMS) {
+                    Log("--streams must be between 1 and %lu", MAX_STREAMS);
+                    return false;
+                }
+                break;
+            case OPT_XDP:
+                run_options.xdp_ifname = optarg;
+                break;
+            case OPT_XDP_QUEUE:
+                run_options.xdp_queue = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_XDP_NATIVE:
+                run_options.xdp_native = true;
+                break;
+            case OPT_USER_TIMESTAMPS:
+                run_options.user_timestamps = true;
+                break;
+            case OPT_DEBUG:
+                run_options.debug = true;
+                break;
+            case OPT_WARMUP:
+                run_options.warmup_ms = strtoull(optarg, NULL, 10);
+                if (run_options.warmup_ms > MAX_WARMUP_MS) {
+                    Log("--warmup must be at most %lu", MAX_WARMUP_MS);
+                    return false;
+                }
+                break;
+            case OPT_MLOCK:
+                run_options.mlock = true;
+                break;
+            case OPT_TRACE_STAGES:
+                run_options.trace_stages_every = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (run_options.spin_poll and run_options.rt_priority > 0) {
+        Log("Warning: spinning SCHED_FIFO threads starve anything sharing their cpu; pin them to dedicated cpus");
+    }
+    return true;
+}
+
+/* print the list of supported options */
+void print_run_options_usage()
+{
+    Log("Options:");
+    Log("  --cc=aimd|bbr      adjust the sending rate from acks (SENDING_RATE is the initial rate)");
+    Log("  --max-rate=MBPS    upper bound for the closed-loop sending rate");
+    Log("  --payload=BYTES    client: payload length of data packets (\"mtu\": the largest that fits the path MTU)");
+    Log("  --ack-every=K      receiving side acks every K packets with one ack block");
+    Log("  --ack-interval=US  receiving side sends a pending ack block after at most US (<= 1000000) microseconds");
+    Log("  --send-cpu=N       pin the sending thread to cpu N");
+    Log("  --recv-cpu=N       pin the receiving thread to cpu N");
+    Log("  --rt-priority=P    run the sending and receiving threads under SCHED_FIFO at priority P");
+    Log("  --busy-poll=US     let the kernel busy poll the socket for up to US microseconds (SO_BUSY_POLL)");
+    Log("  --spin             spin on non-blocking receives in user space");
+    Log("  --rcvbuf=BYTES     socket receive buffer size (SO_RCVBUF)");
+    Log("  --sndbuf=BYTES     socket send buffer size (SO_SNDBUF)");
+    Log("  --force-buffers    size buffers with SO_RCVBUFFORCE / SO_SNDBUFFORCE (needs CAP_NET_ADMIN)");
+    Log("  --daemon           server: keep serving sessions, one log file per session");
+    Log("  --streams=K        client: spread the data flow over K sockets and sending threads");
+    Log("  --xdp=IFNAME       receiving side: reflect acks through an AF_XDP socket on IFNAME");
+    Log("  --xdp-queue=N      receive queue of IFNAME the data flow arrives on (default 0)");
+    Log("  --xdp-native       attach the XDP program in driver mode, zero-copy if supported");
+    Log("  --user-timestamps  log receive times taken in user space instead of kernel timestamps");
+    Log("  --debug            print every packet sent and received");
+    Log("  --warmup=MS        client: send unlogged warm-up packets for MS ms before the measured interval");
+    Log("  --mlock            lock the process in memory, with a pre-faulted heap");
+    Log("  --trace-stages=K   time every K-th packet through each stage of the pipeline, written to LOG_FILE-stages");
+}
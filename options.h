@@ -0,0 +1,95 @@
+#ifndef UDP_OPTIONS_H
+#define UDP_OPTIONS_H
+
+#include <cstdint>
+#include <string>
+
+#include "config.h"
+
+/* optional run-time settings shared by the client and the server */
+struct RunOptions {
+    /* rate controller driven by acks ("aimd" or "bbr"); empty means fixed-rate sending */
+    std::string cc_algorithm = "";
+
+    /* upper bound for the closed-loop sending rate in Mbps (0 = no bound) */
+    double max_rate_mbps = 0.0;
+
+    /* client: payload length of data packets in bytes */
+    uint64_t payload_len = PKT_PAYLOAD_LEN;
+
+    /* client: use the largest payload that fits the path MTU (--payload=mtu) */
+    bool payload_fill_mtu = false;
+
+    /* client: send unlogged warm-up packets at the sending rate for this many ms before the measured interval */
+    uint64_t warmup_ms = 0;
+
+    /* client: split the data flow over this many sockets and sending threads */
+    uint64_t streams = 1;
+
+    /* receiving side: acknowledge every k-th packet with one ack block (1 = one ack per packet) */
+    uint64_t ack_every = 1;
+
+    /* receiving side: send a pending ack block after at most this many us (0 = only every k packets) */
+    uint64_t ack_interval_us = 0;
+
+    /* cpus to pin the sending and receiving threads to (-1 = anywhere) */
+    int send_cpu = -1;
+    int recv_cpu = -1;
+
+    /* SCHED_FIFO priority of the sending and receiving threads (0 = default scheduling) */
+    int rt_priority = 0;
+
+    /* SO_BUSY_POLL time in us for the socket (0 = off) */
+    int busy_poll_us = 0;
+
+    /* spin on non-blocking receives instead of sleeping in the kernel */
+    bool spin_poll = false;
+
+    /* log the time received datagrams reach user space instead of the kernel receive timestamp */
+    bool user_timestamps = false;
+
+    /* print every packet sent and received */
+    bool debug = false;
+
+    /* record the stage timestamps of every k-th packet and write them out after the run (0 = off) */
+    uint64_t trace_stages_every = 0;
+
+    /* lock the process in memory (mlockall) with a pre-faulted heap */
+    bool mlock = false;
+
+    /* socket receive / send buffer sizes in bytes (0 = kernel default) */
+    int rcvbuf_bytes = 0;
+    int sndbuf_bytes = 0;
+
+    /* use SO_RCVBUFFORCE / SO_SNDBUFFORCE to go beyond net.core.[rw]mem_max */
+    bool force_buffers = false;
+
+    /* receiving side: reflect acks through an AF_XDP socket on this interface (empty = socket layer) */
+    std::string xdp_ifname = "";
+
+    /* receive queue of xdp_ifname the data flow arrives on */
+    uint32_t xdp_queue = 0;
+
+    /* attach the XDP program in driver mode (zero-copy if supported) instead of generic mode */
+    bool xdp_native = false;
+
+    /* server: stay bound and serve sessions one after another */
+    bool daemon = false;
+
+    /* was any thread or socket tuning requested? */
+    bool tuning_requested() const
+    {
+        return send_cpu >= 0 or recv_cpu >= 0 or rt_priority > 0 or busy_poll_us > 0 or spin_poll or
+               rcvbuf_bytes > 0 or sndbuf_bytes > 0 or mlock;
+    }
+};
+
+extern RunOptions run_options;
+
+/* parse --long options into run_options; positional arguments are left at argv[optind..] */
+bool parse_run_options(int argc, char **argv);
+
+/* print the list of supported options */
+void print_run_options_usage();
+
+#endif //UDP_OPTIONS_H
@@ -1,9 +1,57 @@
 #include "packet.h"
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
 #include <utility>
 
 using namespace std;
 
+/* host drop counters, updated by send_packet() and recv_packet() on any thread */
+static atomic<uint64_t> send_enobufs_count(0);
+static atomic<uint64_t> send_eagain_count(0);
+static atomic<uint64_t> send_emsgsize_count(0);
+static atomic<uint64_t> rxq_overflow_count(0);
+static atomic<uint64_t> rx_malformed_count(0);
+
+/* UDP sends dropped in the host's queues since boot (Udp and Udp6 SndbufErrors). Without
+   IP_RECVERR the kernel counts a full qdisc there and lets sendto succeed */
+static uint64_t udp_sndbuf_errors()
+{
+    uint64_t errors = 0;
+
+    /* "Udp: <names>" followed by "Udp: <values>" */
+    ifstream snmp("/proc/net/snmp");
+    string names, values;
+    while (getline(snmp, names)) {
+        if (names.compare(0, 4, "Udp:") == 0 and getline(snmp, values)) {
+            istringstream name_stream(names), value_stream(values);
+            string name, value;
+            while (name_stream >> name and value_stream >> value) {
+                if (name == "SndbufErrors") {
+                    errors += strtoull(value.c_str(), NULL, 10);
+                }
+            }
+            break;
+        }
+    }
+
+    ifstream snmp6("/proc/net/snmp6");
+    string name;
+    uint64_t value;
+    while (snmp6 >> name >> value) {
+        if (name == "Udp6SndbufErrors") {
+            errors += value;
+        }
+    }
+    return errors;
+}
+
+/* host-wide counter at the start of the program, so that snapshots count from there */
+static const uint64_t udp_sndbuf_errors_at_start = udp_sndbuf_errors();
+
 /* helper to get the nth uint64_t field (in network byte order) */
 uint64_t get_header_field(const size_t n, const string &str)
 {
@@ -112,23 +160,118 @@ bool Packet::is_ack() const
     return header.ack_sequence_number != uint64_t(-1);
 }
 
-std::string create_packet(uint64_t seq_num) 
+/* Is this packet an ack block? (plain acks carry no payload) */
+bool Packet::is_ack_block() const
+{
+    return is_ack() and not payload.empty();
+}
+
+/* all messages use the same dummy payload, built at start-up rather than with the first packet */
+static const std::string dummy_payload(PKT_PAYLOAD_LEN, 'x');
+
+std::string create_packet(uint64_t seq_num, uint64_t payload_len)
 {
-    /* all messages use the same dummy payload */
-    static const std::string dummy_payload(PKT_PAYLOAD_LEN, 'x');
-    Packet packet(seq_num, dummy_payload);
+    Packet packet(seq_num, payload_len == PKT_PAYLOAD_LEN ? dummy_payload : std::string(payload_len, 'x'));
     packet.set_send_timestamp();  // send immediately
     return packet.to_string();
 }
 
+/* warm-up data packet number n */
+std::string create_warmup_packet(const uint64_t n, const uint64_t payload_len)
+{
+    return create_packet((uint64_t(WARMUP_MAGIC) << 32) | (n & 0xffffffff), payload_len);
+}
 
-void send_packet(const int socket_fd, const struct sockaddr *peer, socklen_t len, const std::string payload)
+/* Is this datagram a warm-up packet or the ack of one? */
+bool is_warmup_message(const std::string &payload)
+{
+    if (payload.size() < sizeof(Packet::Header)) {
+        return false;
+    }
+    return (get_header_field(0, payload) >> 32) == WARMUP_MAGIC;
+}
+
+
+/* send a datagram; returns false if the host dropped it because a queue was full.
+   Any other error (e.g. an unreachable peer) throws, which ends the session */
+bool send_packet(const int socket_fd, const struct sockaddr *peer, socklen_t len, const std::string payload)
 {
     const ssize_t bytes_sent = sendto(socket_fd, payload.data(), payload.size(), 0, peer, len);
-    if(size_t(bytes_sent) != payload.size()) {
-        Error("Could not send packets; Error code: %d", bytes_sent);
-        pthread_exit(NULL);
+    if (bytes_sent == -1 and errno == ENOBUFS) {
+        send_enobufs_count++;
+        return false;
+    }
+    if (bytes_sent == -1 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+        send_eagain_count++;
+        return false;
+    }
+    if (bytes_sent == -1 and errno == EMSGSIZE) {
+        /* the path MTU shrank below the payload (datagrams are never fragmented) */
+        send_emsgsize_count++;
+        return false;
+    }
+    if (bytes_sent == -1 and errno == ECONNREFUSED) {
+        /* the peer has closed its socket, e.g. at the end of its run */
+        return false;
+    }
+    if (bytes_sent == -1) {
+        throw unix_error("sendto");
     }
+    if (size_t(bytes_sent) != payload.size()) {
+        throw runtime_error("sendto: datagram sent in part");
+    }
+    return true;
+}
+
+/* snapshot of the host drop counters */
+HostDrops get_host_drops()
+{
+    return {send_enobufs_count.load(), udp_sndbuf_errors() - udp_sndbuf_errors_at_start, send_eagain_count.load(),
+            send_emsgsize_count.load(), rxq_overflow_count.load(), rx_malformed_count.load()};
+}
+
+/* host drops counted since an earlier snapshot */
+HostDrops HostDrops::since(const HostDrops &start) const
+{
+    return {send_enobufs - start.send_enobufs, send_qdisc - start.send_qdisc, send_eagain - start.send_eagain,
+            send_emsgsize - start.send_emsgsize, rxq_overflow - start.rxq_overflow, rx_malformed - start.rx_malformed};
+}
+
+/* Make human-readable representation of host drops */
+string HostDrops::get_string() const
+{
+    return string_format("host drops: send ENOBUFS %lu; send qdisc (host-wide) %lu; send EAGAIN %lu; send EMSGSIZE %lu; "
+                         "rx queue overflow %lu; rx malformed %lu",
+                         send_enobufs, send_qdisc, send_eagain, send_emsgsize, rxq_overflow, rx_malformed);
+}
+
+/* count a received datagram that is dropped because it cannot be parsed */
+void count_malformed_datagram()
+{
+    rx_malformed_count++;
+}
+
+/* largest payload whose datagram fits the path MTU towards peer unfragmented
+   (MAX_PAYLOAD_LEN when the MTU cannot be found) */
+uint64_t path_max_payload_len(const struct sockaddr_in6 &peer)
+{
+    /* a connected socket learns the MTU of the route, and of the path once ICMP told us */
+    const int fd = dual_stack_udp_socket();
+    if (fd < 0) {
+        return MAX_PAYLOAD_LEN;
+    }
+    int mtu = -1;
+    if (connect(fd, (const struct sockaddr *) &peer, sizeof(peer)) == 0) {
+        mtu = path_mtu(fd);
+    }
+    close(fd);
+
+    const uint64_t headers = (is_ipv4_address(peer) ? IPV4_HEADER_LEN : IPV6_HEADER_LEN) + UDP_HEADER_LEN +
+                             sizeof(Packet::Header);
+    if (mtu < 0 or uint64_t(mtu) <= headers) {
+        return MAX_PAYLOAD_LEN;
+    }
+    return std::min(uint64_t(mtu) - headers, MAX_PAYLOAD_LEN);
 }
 
 int receive_bytes(const int socket_fd, const struct sockaddr *peer, 
@@ -143,11 +286,12 @@ int receive_bytes(const int socket_fd, const struct sockaddr *peer,
     return bytes_read;
 }
 
-/* receive datagram and where it came from */
-received_datagram recv_packet(const int socket_fd)
+/* receive datagram and where it came from; with spin, poll the socket without sleeping.
+   an empty payload means the socket receive timeout expired */
+received_datagram recv_packet(const int socket_fd, const bool spin)
 {
     /* receive source address, timestamp and payload */
-     struct sockaddr_in datagram_source_address;
+    struct sockaddr_in6 datagram_source_address;
     msghdr header{}; zero(header);
     iovec msg_iovec{}; zero(msg_iovec);
 
@@ -170,34 +314,63 @@ received_datagram recv_packet(const int socket_fd)
 
     /* call recvmsg */
     // ssize_t recv_len = SystemCall("recvmsg", recvmsg(socket_fd, &header, 0));
-    ssize_t recv_len = recvmsg(socket_fd, &header, 0);
-    if (recv_len == -1 and errno == EAGAIN) {
-        std::cerr << "recvmsg timeout\n";
-        pthread_exit(NULL);
+    ssize_t recv_len = recvmsg(socket_fd, &header, spin ? MSG_DONTWAIT : 0);
+    if (spin and recv_len == -1 and errno == EAGAIN) {
+        /* keep polling until the socket's receive timeout (if any) would have expired */
+        struct timeval tv{};
+        socklen_t tv_len = sizeof(tv);
+        getsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, &tv_len);
+        const uint64_t timeout_us = tv.tv_sec * 1000000 + tv.tv_usec;
+        const uint64_t spin_start_us = timestamp_us();
+        while (recv_len == -1 and errno == EAGAIN and (timeout_us == 0 or timestamp_us() - spin_start_us < timeout_us)) {
+            header.msg_namelen = sizeof(datagram_source_address);
+            header.msg_controllen = sizeof(msg_control);
+            recv_len = recvmsg(socket_fd, &header, MSG_DONTWAIT);
+        }
+    }
+    if (recv_len == -1 and (errno == EAGAIN or errno == EINTR or errno == ECONNREFUSED)) {
+        /* receive timeout, or the icmp error of a peer that has gone away: no datagram */
+        received_datagram timeout = {datagram_source_address, uint64_t(-1), 0, std::string(), 0};
+        return timeout;
+    }
+    if (recv_len == -1) {
+        throw unix_error("recvmsg");
     }
 
-    /* make sure we got the whole datagram */
-    if (header.msg_flags & MSG_TRUNC) {
-        Error("recvmsg (oversized datagram)");
-    } else if (header.msg_flags) {
-        Error("recvmsg (unhandled flag)");
+    /* anyone can send us an oversized datagram: drop it rather than end the run */
+    if (header.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        count_malformed_datagram();
+        received_datagram dropped = {datagram_source_address, uint64_t(-1), 0, std::string(), 0};
+        return dropped;
     }
 
     uint64_t timestamp = -1;
+    uint64_t kernel_time_ns = 0;
+    uint32_t rxq_dropped = 0;
 
-    /* find the timestamp header (if there is one) */
+    /* find the timestamp and drop counter headers (if there are) */
     cmsghdr *ts_hdr = CMSG_FIRSTHDR(&header);
     while(ts_hdr) {
         if(ts_hdr->cmsg_level == SOL_SOCKET and ts_hdr->cmsg_type == SO_TIMESTAMPNS) {
             const timespec* const kernel_time = reinterpret_cast<timespec*>(CMSG_DATA(ts_hdr));
             timestamp = timestamp_ms(*kernel_time);
+            kernel_time_ns = realtime_ns(*kernel_time);
             // timestamp = timestamp_ms_raw(*kernel_time);
         }
+        if(ts_hdr->cmsg_level == SOL_SOCKET and ts_hdr->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(&rxq_dropped, CMSG_DATA(ts_hdr), sizeof(rxq_dropped));
+            /* several threads may race here: only ever raise the counter */
+            uint64_t seen = rxq_overflow_count.load();
+            while (rxq_dropped > seen and not rxq_overflow_count.compare_exchange_weak(seen, rxq_dropped)) {
+            }
+        }
         ts_hdr = CMSG_NXTHDR(&header, ts_hdr);
     }
 
     received_datagram ret = {datagram_source_address,
                              timestamp,
-                             std::string(msg_payload, recv_len)};
+                             kernel_time_ns,
+                             std::string(msg_payload, recv_len),
+                             rxq_dropped};
     return ret;
 }
\ No newline at end of file
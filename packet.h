@@ -11,10 +11,35 @@
 #include "timestamp.h"
 #include "config.h"
 
+/* Warm-up datagrams are data packets and acks whose sequence number carries
+   WARMUP_MAGIC in its upper half, where real data packets have zeros. They go
+   through the whole send and ack path before the measured interval, but are
+   never logged or counted. */
+const uint32_t WARMUP_MAGIC = 0x55445057; // "UDPW"
+
 struct received_datagram {
-    struct sockaddr_in source_address;
+    struct sockaddr_in6 source_address;  // IPv4 sources are v4-mapped
     uint64_t timestamp;
+    uint64_t kernel_time_ns;  // kernel receive timestamp on the realtime clock (0 = none)
     std::string payload;
+    uint32_t rxq_dropped;  // datagrams dropped by the socket receive queue so far (SO_RXQ_OVFL)
+};
+
+/* datagrams lost inside this host rather than on the path */
+struct HostDrops {
+    uint64_t send_enobufs;   // sendto failed with ENOBUFS: qdisc or device queue full
+    uint64_t send_qdisc;     // UDP sends the qdisc dropped while sendto reported success (Udp SndbufErrors,
+                             // counted for the whole host)
+    uint64_t send_eagain;    // sendto failed with EAGAIN: socket send buffer full
+    uint64_t send_emsgsize;  // sendto failed with EMSGSIZE: datagram beyond the path MTU
+    uint64_t rxq_overflow;   // dropped by the socket receive queue
+    uint64_t rx_malformed;   // received but dropped: truncated, or too short or garbled to parse
+
+    /* drops counted since an earlier snapshot */
+    HostDrops since(const HostDrops &start) const;
+
+    /* Make human-readable representation */
+    std::string get_string() const;
 };
 
 struct Packet
@@ -62,11 +87,28 @@ struct Packet
 
     /* Is this message an ack? */
     bool is_ack() const;
+
+    /* Is this message an ack block acknowledging several packets? */
+    bool is_ack_block() const;
 };
 
-void send_packet(const int socket_fd, const struct sockaddr *peer, socklen_t len, const std::string payload);
+bool send_packet(const int socket_fd, const struct sockaddr *peer, socklen_t len, const std::string payload);
 int receive_bytes(const int socket_fd, const struct sockaddr *peer, char *recv_buffer, size_t read_size);
-received_datagram recv_packet(const int socket_fd);
-std::string create_packet(uint64_t seq_num);
+received_datagram recv_packet(const int socket_fd, const bool spin = false);
+std::string create_packet(uint64_t seq_num, uint64_t payload_len = PKT_PAYLOAD_LEN);
+HostDrops get_host_drops();
+
+/* count a received datagram that is dropped because it cannot be parsed */
+void count_malformed_datagram();
+
+/* warm-up data packet number n */
+std::string create_warmup_packet(uint64_t n, uint64_t payload_len);
+
+/* Is this datagram a warm-up packet or the ack of one? */
+bool is_warmup_message(const std::string &payload);
+
+/* largest payload whose datagram fits the path MTU towards peer unfragmented
+   (MAX_PAYLOAD_LEN when the MTU cannot be found) */
+uint64_t path_max_payload_len(const struct sockaddr_in6 &peer);
 
 #endif //UDP_PACKET_H
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "pipeline.h"
+
+/* Each entry point picks the loop specialization for the run options once,
+   before the first packet. */
+
+/* run a loop; an error it cannot recover from ends the session, not the
+   process, so a daemon goes on with the next client */
+template <typename Loop>
+static void end_session_on_error(Pipeline &pipeline, const char *role, Loop loop)
+{
+    try {
+        loop();
+    } catch (const std::exception &e) {
+        Log("%s: %s (ending the session)", role, e.what());
+        *pipeline.sender_running = false;
+    }
+}
+
+template <typename Io, typename Timestamps, typename Logger, typename Tracer, typename Polling>
+static void run_ack_loop(Pipeline &pipeline, Io io)
+{
+    if (run_options.ack_every > 1 or run_options.ack_interval_us > 0)
+        ack_loop<Io, Timestamps, Logger, Tracer, Polling, AggregatedAcks>(pipeline, io);
+    else
+        ack_loop<Io, Timestamps, Logger, Tracer, Polling, PerPacketAcks>(pipeline, io);
+}
+
+template <typename Io, typename Timestamps, typename Tracer>
+static void run_ack_loop(Pipeline &pipeline, Io io)
+{
+    if (run_options.debug and run_options.spin_poll)
+        run_ack_loop<Io, Timestamps, DebugLogger, Tracer, SpinningPoll>(pipeline, io);
+    else if (run_options.debug)
+        run_ack_loop<Io, Timestamps, DebugLogger, Tracer, SleepingPoll>(pipeline, io);
+    else if (run_options.spin_poll)
+        run_ack_loop<Io, Timestamps, CsvLogger, Tracer, SpinningPoll>(pipeline, io);
+    else
+        run_ack_loop<Io, Timestamps, CsvLogger, Tracer, SleepingPoll>(pipeline, io);
+}
+
+template <typename Tracer>
+static void run_ack_loop(Pipeline &pipeline, XdpReflector *xdp)
+{
+    if (xdp)
+        // no kernel receive timestamps on this path
+        run_ack_loop<XdpIo, UserTimestamps, Tracer>(pipeline, XdpIo(*xdp));
+    else if (run_options.user_timestamps)
+        run_ack_loop<SocketIo, UserTimestamps, Tracer>(pipeline, SocketIo(pipeline));
+    else
+        run_ack_loop<SocketIo, KernelTimestamps, Tracer>(pipeline, SocketIo(pipeline));
+}
+
+/* keep receiving packets and send acks (used on receiving side) */
+void recv_packets_and_send_ack(Pipeline &pipeline)
+{
+    // optional AF_XDP data path: acks are written over the received frames
+    std::unique_ptr<XdpReflector> xdp = open_xdp_reflector(pipeline.fd, pipeline.peer);
+    end_session_on_error(pipeline, "receive", [&] {
+        if (pipeline.stage_trace)
+            run_ack_loop<SampledTrace>(pipeline, xdp.get());
+        else
+            run_ack_loop<NoTrace>(pipeline, xdp.get());
+    });
+    if (xdp) {
+        Log("%s", xdp->get_string().c_str());
+        *pipeline.log << "# " << xdp->get_string() << "\n";
+    }
+}
+
+/* thread entry for recv_packets_and_send_ack */
+void *recv_and_ack_udp_packets(void *pipeline_ptr)
+{
+    recv_packets_and_send_ack(*((Pipeline*) pipeline_ptr));
+    return NULL;
+}
+
+template <typename Tracer>
+static void run_send_loop(Pipeline &pipeline)
+{
+    if (pipeline.rate_controller and run_options.debug)
+        send_loop<ClosedLoopPacing, DebugLogger, Tracer>(pipeline);
+    else if (pipeline.rate_controller)
+        send_loop<ClosedLoopPacing, CsvLogger, Tracer>(pipeline);
+    else if (run_options.debug)
+        send_loop<FixedPacing, DebugLogger, Tracer>(pipeline);
+    else
+        send_loop<FixedPacing, CsvLogger, Tracer>(pipeline);
+}
+
+/* use this function to send packets over a socket. */
+void *send_udp_packets(void *pipeline_ptr)
+{
+    Pipeline &pipeline = *((Pipeline*) pipeline_ptr);
+    end_session_on_error(pipeline, "send", [&] {
+        if (pipeline.stage_trace)
+            run_send_loop<SampledTrace>(pipeline);
+        else
+            run_send_loop<NoTrace>(pipeline);
+    });
+    return NULL;
+}
+
+template <typename Timestamps, typename Logger, typename Tracer, typename Polling>
+static void run_ack_receive_loop(Pipeline &pipeline)
+{
+    if (dynamic_cast<AIMDController *>(pipeline.rate_controller))
+        ack_receive_loop<Timestamps, Logger, Tracer, Polling, ControllerFeedback<AIMDController>>(pipeline);
+    else if (dynamic_cast<BBRController *>(pipeline.rate_controller))
+        ack_receive_loop<Timestamps, Logger, Tracer, Polling, ControllerFeedback<BBRController>>(pipeline);
+    else if (not pipeline.rate_controller)
+        ack_receive_loop<Timestamps, Logger, Tracer, Polling, OpenLoopFeedback>(pipeline);
+    else
+        throw std::runtime_error(std::string("no feedback policy for rate controller ") + pipeline.rate_controller->name());
+}
+
+template <typename Timestamps, typename Tracer>
+static void run_ack_receive_loop(Pipeline &pipeline)
+{
+    if (run_options.debug and run_options.spin_poll)
+        run_ack_receive_loop<Timestamps, DebugLogger, Tracer, SpinningPoll>(pipeline);
+    else if (run_options.debug)
+        run_ack_receive_loop<Timestamps, DebugLogger, Tracer, SleepingPoll>(pipeline);
+    else if (run_options.spin_poll)
+        run_ack_receive_loop<Timestamps, CsvLogger, Tracer, SpinningPoll>(pipeline);
+    else
+        run_ack_receive_loop<Timestamps, CsvLogger, Tracer, SleepingPoll>(pipeline);
+}
+
+template <typename Tracer>
+static void run_ack_receive_loop(Pipeline &pipeline)
+{
+    if (run_options.user_timestamps)
+        run_ack_receive_loop<UserTimestamps, Tracer>(pipeline);
+    else
+        run_ack_receive_loop<KernelTimestamps, Tracer>(pipeline);
+}
+
+/* send the warm-up and then the flow over several streams (--streams) */
+void send_stream_flow(Pipeline &pipeline, StreamSenders &senders, const StreamFlow &flow)
+{
+    end_session_on_error(pipeline, "send", [&] {
+        send_warmup(pipeline);
+        senders.run(flow);
+    });
+}
+
+/* use this function to receive acks over a socket and match them against the send history */
+void *recv_udp_packets(void *pipeline_ptr)
+{
+    Pipeline &pipeline = *((Pipeline*) pipeline_ptr);
+    end_session_on_error(pipeline, "receive", [&] {
+        if (pipeline.stage_trace)
+            run_ack_receive_loop<SampledTrace>(pipeline);
+        else
+            run_ack_receive_loop<NoTrace>(pipeline);
+    });
+    return NULL;
+}
@@ -0,0 +1,671 @@
+#ifndef UDP_PIPELINE_H
+#define UDP_PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+
+#include "config.h"
+#include "options.h"
+#include "packet.h"
+#include "timestamp.h"
+#include "congestion.h"
+#include "ack_block.h"
+#include "send_history.h"
+#include "control.h"
+#include "clock_sync.h"
+#include "multi_stream.h"
+#include "xdp_reflector.h"
+#include "stage_trace.h"
+
+/* Packet pipeline shared by the client and the server. The sending loop, the
+   ack-receiving loop and the ack-reflecting loop are templates over policies:
+
+     Io          where datagrams come from and acks go (socket or AF_XDP)
+     Timestamps  which receive time is logged and acked (kernel or user space)
+     Logger      what is recorded per packet (CSV log, or CSV plus a console trace)
+     Pacing      when the next data packets are due (fixed rate or rate controller)
+     Tracer      which packets have their stage timestamps recorded (none or every k-th)
+     Polling     how a receive waits for a datagram (sleeping in the kernel or spinning)
+     Acks        how data packets are acknowledged (one ack each or ack blocks)
+     Feedback    what the acks drive on the sending side (nothing or a rate controller)
+
+   The run options select one specialization per loop when the loop starts
+   (see pipeline.cpp), so the per-packet path has no branches on settings and
+   no virtual calls. A new backend is one more policy class and one more case
+   in the dispatch. */
+
+/* one run of the pipeline: the socket, the peer and the per-run state the
+   loops share; the binaries own the state, the pipeline points at it */
+struct Pipeline {
+    int fd;
+    struct sockaddr_in6 peer;
+    bool is_client;                    // picks the one-way delay direction; a client answers late control messages
+    const SessionParams *session;
+    uint64_t duration_ms;
+    uint64_t payload_len;
+    uint64_t milliseconds_to_sleep;    // open-loop pacing: pkts_to_send packets every milliseconds_to_sleep
+    uint64_t pkts_to_send;
+    uint64_t loss_reorder_threshold;
+    std::atomic<bool> *sender_running; // cleared when the sender is done or must stop
+    RateController *rate_controller;   // closed-loop sending (may be null)
+    SendHistory *send_history;
+    RttStats *rtt_stats;
+    ClockSync *clock_sync;
+    StreamReassembly *reassembly;
+    uint32_t *rxq_dropped;             // SO_RXQ_OVFL already reported for fd
+    StageTrace *stage_trace;           // per-packet stage timestamps (may be null)
+    std::ofstream *log;
+    std::ofstream *cc_log;
+};
+
+/* keep receiving packets and send acks (used on receiving side) */
+void recv_packets_and_send_ack(Pipeline &pipeline);
+
+/* thread entry for recv_packets_and_send_ack */
+void *recv_and_ack_udp_packets(void *pipeline_ptr);
+
+/* use this function to send packets over a socket. */
+void *send_udp_packets(void *pipeline_ptr);
+
+/* use this function to receive acks over a socket and match them against the send history */
+void *recv_udp_packets(void *pipeline_ptr);
+
+/* send the warm-up and then the flow over several streams (--streams) */
+void send_stream_flow(Pipeline &pipeline, StreamSenders &senders, const StreamFlow &flow);
+
+/* I/O backends */
+
+/* the UDP socket of the run */
+class SocketIo
+{
+public:
+    explicit SocketIo(const Pipeline &pipeline) : fd_(pipeline.fd), peer_(pipeline.peer) {}
+
+    /* next datagram; an empty payload means the socket receive timeout expired */
+    received_datagram receive(const bool spin) { return recv_packet(fd_, spin); }
+
+    /* wait until a datagram is ready; returns false on timeout */
+    bool wait_readable(const uint64_t timeout_us) { return ::wait_readable(fd_, timeout_us); }
+
+    /* send to the peer; returns false if the host dropped the datagram */
+    bool send(const std::string &payload) { return send_packet(fd_, (struct sockaddr *) &peer_, sizeof(peer_), payload); }
+
+    /* answer the last received datagram */
+    void reflect(const std::string &payload) { send(payload); }
+
+private:
+    int fd_;
+    struct sockaddr_in6 peer_;
+};
+
+/* an AF_XDP socket on one receive queue (--xdp) */
+class XdpIo
+{
+public:
+    explicit XdpIo(XdpReflector &reflector) : reflector_(reflector) {}
+
+    received_datagram receive(const bool spin) { return reflector_.receive(RECV_POLL_INTERVAL_MS, spin); }
+    bool wait_readable(const uint64_t timeout_us) { return reflector_.wait_readable(timeout_us); }
+    bool send(const std::string &payload) { reflector_.send(payload); return true; }
+    void reflect(const std::string &payload) { reflector_.reflect(payload); }
+
+private:
+    XdpReflector &reflector_;
+};
+
+/* receive time sources, in ms on the clock of timestamp_ms() */
+
+/* the kernel's receive timestamp (SO_TIMESTAMPNS), or now if the datagram has none */
+struct KernelTimestamps {
+    static uint64_t receive_time(const received_datagram &datagram)
+    {
+        return datagram.timestamp != uint64_t(-1) ? datagram.timestamp : timestamp_ms();
+    }
+};
+
+/* the time the datagram reaches the loop in user space */
+struct UserTimestamps {
+    static uint64_t receive_time(const received_datagram &)
+    {
+        return timestamp_ms();
+    }
+};
+
+/* per-packet loggers */
+
+/* one CSV record per received packet */
+struct CsvLogger {
+    static void on_send(uint64_t) {}
+
+    static void on_receive(std::ofstream &log, const Packet &packet, const uint64_t recv_timestamp, const OneWayDelays &owd)
+    {
+        log << string_format("%d, %d, %d, %d, %d, %d, %d, %d, %d, %.3f, %.3f\n",
+                             packet.is_ack(),
+                             packet.header.sequence_number,
+                             packet.header.send_timestamp,
+                             packet.header.ack_sequence_number,
+                             packet.header.ack_send_timestamp,
+                             packet.header.ack_recv_timestamp,
+                             recv_timestamp,
+                             packet.header.ack_payload_length,
+                             get_current_timestamp(),
+                             owd.up_ms,
+                             owd.down_ms);
+    }
+};
+
+/* the CSV log, plus every packet on the console (--debug) */
+struct DebugLogger {
+    static void on_send(const uint64_t sequence_number)
+    {
+        if (sequence_number == 0)
+            Log("Last Custom message sent");
+        else
+            Log("Custom message sent");
+    }
+
+    static void on_receive(std::ofstream &log, const Packet &packet, const uint64_t recv_timestamp, const OneWayDelays &owd)
+    {
+        Log("Custom message received ==> %d, %d, %d, %d, %d, %d, %d, %d",
+            packet.is_ack(),
+            packet.header.sequence_number,
+            packet.header.send_timestamp,
+            packet.header.ack_sequence_number,
+            packet.header.ack_send_timestamp,
+            packet.header.ack_recv_timestamp,
+            recv_timestamp,
+            packet.header.ack_payload_length);
+        CsvLogger::on_receive(log, packet, recv_timestamp, owd);
+    }
+};
+
+/* per-packet stage timestamps */
+
+/* no tracing: every call compiles away */
+struct NoTrace {
+    explicit NoTrace(const Pipeline &) {}
+    bool sampled(uint64_t) const { return false; }
+    uint64_t now_ns() const { return 0; }
+    void record(uint64_t, Stage, uint64_t) {}
+};
+
+/* every k-th packet into the StageTrace of the run (--trace-stages) */
+class SampledTrace
+{
+public:
+    explicit SampledTrace(const Pipeline &pipeline) : trace_(*pipeline.stage_trace) {}
+
+    /* is this packet traced? */
+    bool sampled(const uint64_t sequence_number) const { return trace_.sampled(sequence_number); }
+
+    /* time of a stage, on the clock of kernel receive timestamps */
+    uint64_t now_ns() const { return realtime_ns(); }
+
+    void record(const uint64_t sequence_number, const Stage stage, const uint64_t time_ns)
+    {
+        trace_.record(sequence_number, stage, time_ns);
+    }
+
+private:
+    StageTrace &trace_;
+};
+
+/* waiting for datagrams */
+
+/* sleep in the receive call until a datagram arrives or the timeout expires */
+struct SleepingPoll {
+    static const bool spin = false;
+};
+
+/* spin on non-blocking receives (--spin) */
+struct SpinningPoll {
+    static const bool spin = true;
+};
+
+/* pacing of the sending loop */
+
+/* open loop: pkts_to_send packets every milliseconds_to_sleep ms */
+class FixedPacing
+{
+public:
+    explicit FixedPacing(const Pipeline &pipeline)
+        : pkts_to_send_(pipeline.pkts_to_send), milliseconds_to_sleep_(pipeline.milliseconds_to_sleep) {}
+
+    /* packets to send now */
+    uint64_t due(uint64_t) { return pkts_to_send_; }
+
+    /* time to sleep before the next round */
+    uint64_t sleep_ms() const { return milliseconds_to_sleep_; }
+
+private:
+    uint64_t pkts_to_send_;
+    uint64_t milliseconds_to_sleep_;
+};
+
+/* closed loop: accumulate sending credit at the controller's current rate */
+class ClosedLoopPacing
+{
+public:
+    explicit ClosedLoopPacing(const Pipeline &pipeline)
+        : rate_controller_(*pipeline.rate_controller),
+        rate_const_(sending_rate_const(pipeline.payload_len)),
+        credit_(0.0),
+        last_tick_ms_(timestamp_ms()) {}
+
+    uint64_t due(const uint64_t now_ms)
+    {
+        double pkts_per_ms = rate_controller_.pacing_rate_mbps() * rate_const_;
+        credit_ = std::min(credit_ + pkts_per_ms * (now_ms - last_tick_ms_), std::max(1.0, pkts_per_ms * CC_MAX_BURST_MS));
+        last_tick_ms_ = now_ms;
+        uint64_t packets = uint64_t(credit_);
+        credit_ -= packets;
+        return packets;
+    }
+
+    uint64_t sleep_ms() const { return 1; }
+
+private:
+    RateController &rate_controller_;
+    const double rate_const_;
+    double credit_;
+    uint64_t last_tick_ms_;
+};
+
+/* acknowledgement of data packets */
+
+/* one ack per data packet, written over the packet */
+class PerPacketAcks
+{
+public:
+    explicit PerPacketAcks(const Pipeline &) : ack_seq_no_(1) {}
+
+    /* before a receive; returns false if an ack went out instead */
+    template <typename Io, typename Tracer>
+    bool wait(Io &, Tracer &) { return true; }
+
+    /* acknowledge a logged data packet */
+    template <typename Io, typename Tracer>
+    void on_data(Io &io, Tracer &tracer, Packet &packet, const uint64_t recv_timestamp)
+    {
+        uint64_t data_seq = packet.header.sequence_number;
+        packet.transform_into_ack(ack_seq_no_++, recv_timestamp);
+        packet.set_send_timestamp();
+        std::string ack = packet.to_string();
+        if (tracer.sampled(data_seq))
+            tracer.record(data_seq, STAGE_ACK_BUILT, tracer.now_ns());
+        io.reflect(ack);
+        if (tracer.sampled(data_seq))
+            tracer.record(data_seq, STAGE_ACK_SENT, tracer.now_ns());
+    }
+
+    /* at the end of the run, acknowledge what is pending */
+    template <typename Io, typename Tracer>
+    void flush(Io &, Tracer &) {}
+
+private:
+    uint64_t ack_seq_no_;
+};
+
+/* one ack block every k packets or every T us (--ack-every, --ack-interval) */
+class AggregatedAcks
+{
+public:
+    explicit AggregatedAcks(const Pipeline &)
+        : aggregator_(run_options.ack_every, run_options.ack_interval_us),
+        max_delay_us_(run_options.ack_interval_us),
+        ack_seq_no_(1) {}
+
+    /* with a block pending, wait no longer than its deadline */
+    template <typename Io, typename Tracer>
+    bool wait(Io &io, Tracer &tracer)
+    {
+        if (max_delay_us_ > 0 and not aggregator_.empty() and
+            not io.wait_readable(aggregator_.time_to_flush(timestamp_us()))) {
+            send_block(io, tracer);
+            return false;
+        }
+        return true;
+    }
+
+    template <typename Io, typename Tracer>
+    void on_data(Io &io, Tracer &tracer, Packet &packet, const uint64_t recv_timestamp)
+    {
+        if (not aggregator_.fits(packet.header.sequence_number, packet.payload.length()))
+            send_block(io, tracer);
+        aggregator_.add({packet.header.sequence_number, packet.header.send_timestamp, recv_timestamp},
+                        packet.payload.length(), timestamp_us());
+        if (aggregator_.due(timestamp_us()))
+            send_block(io, tracer);
+    }
+
+    template <typename Io, typename Tracer>
+    void flush(Io &io, Tracer &tracer)
+    {
+        if (not aggregator_.empty())
+            send_block(io, tracer);
+    }
+
+private:
+    /* the ack stages of a traced packet are those of the block that covers it */
+    template <typename Io, typename Tracer>
+    void send_block(Io &io, Tracer &tracer)
+    {
+        traced_.clear();
+        for (const AckRecord &record : aggregator_.records())
+            if (tracer.sampled(record.sequence_number))
+                traced_.push_back(record.sequence_number);
+        Packet ack = aggregator_.make_ack(ack_seq_no_++);
+        ack.set_send_timestamp();
+        std::string block = ack.to_string();
+        uint64_t built_ns = tracer.now_ns();
+        io.send(block);
+        uint64_t sent_ns = tracer.now_ns();
+        for (uint64_t data_seq : traced_) {
+            tracer.record(data_seq, STAGE_ACK_BUILT, built_ns);
+            tracer.record(data_seq, STAGE_ACK_SENT, sent_ns);
+        }
+    }
+
+    AckAggregator aggregator_;
+    const uint64_t max_delay_us_;
+    uint64_t ack_seq_no_;
+    std::vector<uint64_t> traced_;   // traced packets of the block being sent
+};
+
+/* what the acks drive on the sending side */
+
+/* open loop: acks are only logged and matched */
+struct OpenLoopFeedback {
+    explicit OpenLoopFeedback(const Pipeline &) {}
+    void on_lost(uint64_t) {}
+    void on_ack(const Packet &, uint64_t) {}
+};
+
+/* closed loop: every newly acked packet goes to the rate controller, an Algorithm
+   (AIMDController or BBRController) whose update is bound at compile time */
+template <typename Algorithm>
+class ControllerFeedback
+{
+public:
+    explicit ControllerFeedback(const Pipeline &pipeline)
+        : rate_controller_(static_cast<Algorithm &>(*pipeline.rate_controller)),
+        cc_log_(*pipeline.cc_log),
+        lost_since_sample_(0) {}
+
+    /* packets declared lost by the send history */
+    void on_lost(const uint64_t lost) { lost_since_sample_ += lost; }
+
+    /* an ack of a packet not acked before */
+    void on_ack(const Packet &packet, const uint64_t recv_timestamp)
+    {
+        AckSample ack = {packet.header.ack_sequence_number,
+                         packet.header.ack_send_timestamp,
+                         packet.header.ack_recv_timestamp,
+                         recv_timestamp,
+                         packet.header.ack_payload_length,
+                         lost_since_sample_};
+        lost_since_sample_ = 0;
+        if (rate_controller_.template on_ack<Algorithm>(ack))
+            cc_log_ << rate_controller_.get_state() << "\n";
+    }
+
+private:
+    Algorithm &rate_controller_;
+    std::ofstream &cc_log_;
+    uint64_t lost_since_sample_;
+};
+
+/* the loops */
+
+/* send the unlogged warm-up packets of the session at the initial rate, so
+   the send path, the peer's ack path and the ack-receiving loop are warm when
+   the measured interval starts */
+inline void send_warmup(Pipeline &pipeline)
+{
+    if (pipeline.session->warmup_ms == 0)
+        return;
+    SocketIo io(pipeline);
+    FixedPacing pacing(pipeline);
+    uint64_t n = 1;
+    uint64_t start_time_ms = timestamp_ms();
+
+    while ((timestamp_ms() - start_time_ms) < pipeline.session->warmup_ms and *pipeline.sender_running) {
+        for (uint64_t packets = pacing.due(timestamp_ms()); packets > 0; packets--)
+            io.send(create_warmup_packet(n++, pipeline.payload_len));
+        std::this_thread::sleep_for(std::chrono::milliseconds(pacing.sleep_ms()));
+    }
+}
+
+/* send data packets until the duration is over or the run is stopped, then the end-of-run packets */
+template <typename Pacing, typename Logger, typename Tracer>
+void send_loop(Pipeline &pipeline)
+{
+    send_warmup(pipeline);
+    SocketIo io(pipeline);
+    Pacing pacing(pipeline);
+    Tracer tracer(pipeline);
+    uint64_t seq_no = 1;
+    uint64_t start_time_ms = timestamp_ms();
+
+    while ((timestamp_ms() - start_time_ms) <= pipeline.duration_ms and *pipeline.sender_running) {
+        for (uint64_t packets = pacing.due(timestamp_ms()); packets > 0; packets--) {
+            uint64_t seq = seq_no++;
+            bool traced = tracer.sampled(seq);
+            if (traced)
+                tracer.record(seq, STAGE_GENERATE, tracer.now_ns());
+            std::string message = create_packet(seq, pipeline.payload_len);
+            pipeline.send_history->on_send(seq, timestamp_us());
+            if (traced)
+                tracer.record(seq, STAGE_SEND, tracer.now_ns());
+            bool sent = io.send(message);
+            if (traced)
+                tracer.record(seq, STAGE_SENT, tracer.now_ns());
+            if (not sent)
+                pipeline.send_history->forget(seq);
+            Logger::on_send(seq);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(pacing.sleep_ms()));
+    }
+
+    // send a few times just in case
+    std::string message = create_packet(0, pipeline.payload_len);
+    for (int i = 0; i < 5; i++)
+        io.send(message);
+    Logger::on_send(0);
+    *pipeline.sender_running = false;
+}
+
+/* the receive-side preamble both receive loops share: clock probes and
+   replies, warm-up packets, handshake leftovers and drop counters. Returns true if the
+   datagram is a data packet or ack for the caller */
+template <typename Io>
+bool accept_datagram(Pipeline &pipeline, Io &io, const received_datagram &message)
+{
+    if (is_control_message(message.payload)) {
+        // leftovers of the handshake; for a client, a START that got lost
+        if (pipeline.is_client)
+            client_on_late_control(pipeline.fd, pipeline.peer, message.payload, *pipeline.session);
+        return false;
+    }
+    if (is_clock_message(message.payload)) {
+        std::string reply = pipeline.clock_sync->on_message(message.payload);
+        if (not reply.empty())
+            io.send(reply);
+        return false;
+    }
+    if (is_warmup_message(message.payload)) {
+        // warm-up packets are acked over the ack path, unlogged; their acks end here
+        Packet packet = message.payload;
+        if (not packet.is_ack()) {
+            packet.transform_into_ack(packet.header.sequence_number, timestamp_ms());
+            packet.set_send_timestamp();
+            io.reflect(packet.to_string());
+        }
+        return false;
+    }
+    // datagrams taken by AF_XDP carry no socket drop counter
+    if (message.rxq_dropped > *pipeline.rxq_dropped) {
+        *pipeline.log << "# rx queue overflow: " << message.rxq_dropped - *pipeline.rxq_dropped << " datagrams dropped\n";
+        *pipeline.rxq_dropped = message.rxq_dropped;
+    }
+    return true;
+}
+
+/* send a clock probe when one is due: a burst at the start, then one now and then */
+inline void send_clock_probe(Pipeline &pipeline)
+{
+    if (pipeline.clock_sync->probe_due(log_timestamp_us()))
+        send_packet(pipeline.fd, (struct sockaddr *) &pipeline.peer, sizeof(pipeline.peer),
+                    pipeline.clock_sync->make_probe(log_timestamp_us()));
+}
+
+/* receive data packets, log them and answer with acks or ack blocks */
+template <typename Io, typename Timestamps, typename Logger, typename Tracer, typename Polling, typename Acks>
+void ack_loop(Pipeline &pipeline, Io io)
+{
+    Tracer tracer(pipeline);
+    Acks acks(pipeline);
+    uint64_t start_time_ms = timestamp_ms();
+    uint64_t last_recv_ms = start_time_ms;
+
+    while (true) {
+        send_clock_probe(pipeline);
+        if (not acks.wait(io, tracer))
+            continue;
+        received_datagram message = io.receive(Polling::spin);
+        uint64_t user_rx_ns = tracer.now_ns();
+        if (message.payload.empty()) {
+            // nothing within the receive timeout: has the peer gone away?
+            if ((timestamp_ms() - last_recv_ms) >= SERVER_RECV_MSG_TIMEOUT * 1000) {
+                Log("recvmsg timeout (exiting)!");
+                break;
+            }
+            continue;
+        }
+        // unconnected when the data comes over several streams: only take datagrams from the peer's host
+        if (not same_host(message.source_address, pipeline.peer))
+            continue;
+        last_recv_ms = timestamp_ms();
+        if (not accept_datagram(pipeline, io, message))
+            continue;
+
+        // too short for a header: dropped, the run goes on
+        if (message.payload.size() < sizeof(Packet::Header)) {
+            count_malformed_datagram();
+            continue;
+        }
+        uint64_t recv_timestamp = Timestamps::receive_time(message);
+        Packet packet = message.payload;
+        uint64_t data_seq = packet.header.sequence_number;
+        if (tracer.sampled(data_seq)) {
+            if (message.kernel_time_ns != 0)
+                tracer.record(data_seq, STAGE_KERNEL_RX, message.kernel_time_ns);
+            tracer.record(data_seq, STAGE_USER_RX, user_rx_ns);
+        }
+        Logger::on_receive(*pipeline.log, packet, recv_timestamp,
+                           pipeline.clock_sync->one_way_delays(packet, recv_timestamp, pipeline.is_client));
+        if (packet.header.sequence_number > 0)
+            pipeline.reassembly->on_packet(packet.header.sequence_number, ntohs(message.source_address.sin6_port));
+        if (packet.header.sequence_number <= 0) {
+            Log("Last packet received (exiting)!");
+            acks.flush(io, tracer);
+            break;
+        }
+        if ((timestamp_ms() - start_time_ms) >= pipeline.session->warmup_ms + pipeline.duration_ms) {
+            Log("Experiment duration elapsed (exiting)!");
+            acks.flush(io, tracer);
+            break;
+        }
+        acks.on_data(io, tracer, packet, recv_timestamp);
+    }
+}
+
+/* receive acks and log them, until the acks of the last packets had time to come back */
+template <typename Timestamps, typename Logger, typename Tracer, typename Polling, typename Feedback>
+void ack_receive_loop(Pipeline &pipeline)
+{
+    SocketIo io(pipeline);
+    Tracer tracer(pipeline);
+    Feedback feedback(pipeline);
+    uint64_t last_stats_ms = timestamp_ms();
+    uint64_t last_recv_ms = last_stats_ms;
+    uint64_t sender_done_ms = 0;
+
+    while (true) {
+        if (not *pipeline.sender_running and sender_done_ms == 0)
+            sender_done_ms = timestamp_ms();
+        if (sender_done_ms != 0 and (timestamp_ms() - sender_done_ms) >= ACK_DRAIN_MS)
+            break;
+        send_clock_probe(pipeline);
+        received_datagram recv_message = io.receive(Polling::spin);
+        uint64_t user_rx_ns = tracer.now_ns();
+        if (recv_message.payload.empty()) {
+            // nothing within the socket timeout: has the peer gone away?
+            if ((timestamp_ms() - last_recv_ms) >= SERVER_RECV_MSG_TIMEOUT * 1000) {
+                Log("recvmsg timeout");
+                *pipeline.sender_running = false;
+                break;
+            }
+            continue;
+        }
+        last_recv_ms = timestamp_ms();
+        if (not accept_datagram(pipeline, io, recv_message))
+            continue;
+        if (recv_message.payload.size() < sizeof(Packet::Header)) {
+            count_malformed_datagram();
+            continue;
+        }
+        uint64_t recv_time_us = timestamp_us();
+        uint64_t recv_timestamp = Timestamps::receive_time(recv_message);
+        Packet message = recv_message.payload;
+
+        // an ack block stands for several per-packet acks; a garbled one is dropped
+        std::vector<Packet> packets;
+        try {
+            packets = message.is_ack_block() ? expand_ack_block(message) : std::vector<Packet>{message};
+        } catch (const std::runtime_error &) {
+            count_malformed_datagram();
+            continue;
+        }
+        for (const Packet &packet : packets) {
+            Logger::on_receive(*pipeline.log, packet, recv_timestamp,
+                               pipeline.clock_sync->one_way_delays(packet, recv_timestamp, pipeline.is_client));
+
+            // match the ack against the send history for rtt, losses and duplicates
+            SendHistory::AckResult result = SendHistory::ACK_UNKNOWN;
+            if (packet.is_ack() and tracer.sampled(packet.header.ack_sequence_number)) {
+                if (recv_message.kernel_time_ns != 0)
+                    tracer.record(packet.header.ack_sequence_number, STAGE_ACK_KERNEL_RX, recv_message.kernel_time_ns);
+                tracer.record(packet.header.ack_sequence_number, STAGE_ACK_USER_RX, user_rx_ns);
+            }
+            if (packet.is_ack()) {
+                uint64_t send_time_us = 0;
+                result = pipeline.send_history->on_ack(packet.header.ack_sequence_number, send_time_us);
+                pipeline.rtt_stats->count(result);
+                if (result == SendHistory::ACK_NEW or result == SendHistory::ACK_LATE)
+                    pipeline.rtt_stats->add(recv_time_us - send_time_us);
+                uint64_t lost = pipeline.send_history->detect_losses(packet.header.ack_sequence_number,
+                                                                     pipeline.loss_reorder_threshold);
+                pipeline.rtt_stats->count_lost(lost);
+                feedback.on_lost(lost);
+            }
+
+            // duplicated acks would count their packet as delivered twice
+            if (result == SendHistory::ACK_NEW or result == SendHistory::ACK_LATE)
+                feedback.on_ack(packet, recv_timestamp);
+        }
+
+        if (timestamp_ms() - last_stats_ms >= RTT_STATS_INTERVAL_MS) {
+            Log("%s; %s", pipeline.rtt_stats->get_string().c_str(), get_host_drops().get_string().c_str());
+            last_stats_ms = timestamp_ms();
+        }
+    }
+}
+
+#endif //UDP_PIPELINE_H
@@ -0,0 +1,162 @@
+#include "send_history.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+/* capacity is rounded up to a power of two */
+static uint64_t round_up_to_power_of_two(const uint64_t n)
+{
+    uint64_t capacity = 1;
+    while (capacity < n) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+SendHistory::SendHistory(const uint64_t capacity)
+    : mask_(round_up_to_power_of_two(capacity) - 1),
+    slots_(new Slot[mask_ + 1]),
+    next_loss_check_(1)
+{
+    reset();
+}
+
+/* forget everything, before a new session (no other thread may use the history) */
+void SendHistory::reset()
+{
+    for (uint64_t i = 0; i <= mask_; i++) {
+        slots_[i].tag.store(EMPTY_TAG, memory_order_relaxed);
+        slots_[i].send_time_us.store(0, memory_order_relaxed);
+    }
+    next_loss_check_ = 1;
+}
+
+/* record a packet just before it is sent (sending thread) */
+void SendHistory::on_send(const uint64_t sequence_number, const uint64_t send_time_us)
+{
+    Slot &slot = slots_[sequence_number & mask_];
+
+    /* invalidate the slot first so a reader never pairs the old tag with the new time */
+    slot.tag.store(EMPTY_TAG);
+    slot.send_time_us.store(send_time_us);
+    slot.tag.store(sequence_number);
+}
+
+/* forget a packet the host failed to send, so it is not taken for path loss (sending thread) */
+void SendHistory::forget(const uint64_t sequence_number)
+{
+    slots_[sequence_number & mask_].tag.store(EMPTY_TAG);
+}
+
+/* look up and mark the packet acked, filling in its send time (receiving thread) */
+SendHistory::AckResult SendHistory::on_ack(const uint64_t sequence_number, uint64_t &send_time_us)
+{
+    Slot &slot = slots_[sequence_number & mask_];
+
+    uint64_t tag = slot.tag.load();
+    if ((tag & SEQUENCE_MASK) != sequence_number) {
+        return ACK_UNKNOWN;
+    }
+    if (tag & STATE_ACKED) {
+        return ACK_DUPLICATE;
+    }
+
+    send_time_us = slot.send_time_us.load();
+
+    /* fails if the sending thread reused the slot meanwhile, which also makes the time stale */
+    if (not slot.tag.compare_exchange_strong(tag, sequence_number | STATE_ACKED)) {
+        return ACK_UNKNOWN;
+    }
+    return (tag & STATE_LOST) ? ACK_LATE : ACK_NEW;
+}
+
+/* declare unacked packets lost once an ack arrives reorder_threshold packets beyond them;
+   returns the number of newly lost packets (receiving thread) */
+uint64_t SendHistory::detect_losses(const uint64_t acked_sequence_number, const uint64_t reorder_threshold)
+{
+    if (acked_sequence_number <= reorder_threshold) {
+        return 0;
+    }
+    const uint64_t last = acked_sequence_number - reorder_threshold;
+
+    /* slots older than one ring are gone */
+    next_loss_check_ = max(next_loss_check_, last > mask_ ? last - mask_ : uint64_t(1));
+
+    uint64_t lost = 0;
+    for (; next_loss_check_ <= last; next_loss_check_++) {
+        uint64_t tag = next_loss_check_;
+        if (slots_[next_loss_check_ & mask_].tag.compare_exchange_strong(tag, next_loss_check_ | STATE_LOST)) {
+            lost++;
+        }
+    }
+    return lost;
+}
+
+RttStats::RttStats()
+    : samples_(0),
+    min_us_(-1),
+    max_us_(0),
+    mean_us_(0.0),
+    srtt_us_(0.0),
+    rttvar_us_(0.0),
+    lost_(0),
+    late_(0),
+    duplicates_(0),
+    unknown_(0)
+{}
+
+/* add an rtt sample */
+void RttStats::add(const uint64_t rtt_us)
+{
+    samples_++;
+    min_us_ = min(min_us_, rtt_us);
+    max_us_ = max(max_us_, rtt_us);
+    mean_us_ += (rtt_us - mean_us_) / samples_;
+
+    /* RFC 6298 estimators */
+    if (samples_ == 1) {
+        srtt_us_ = rtt_us;
+        rttvar_us_ = rtt_us / 2.0;
+    } else {
+        rttvar_us_ = 0.75 * rttvar_us_ + 0.25 * fabs(srtt_us_ - rtt_us);
+        srtt_us_ = 0.875 * srtt_us_ + 0.125 * rtt_us;
+    }
+}
+
+/* count acks by what they told us */
+void RttStats::count(const SendHistory::AckResult result)
+{
+    switch (result) {
+        case SendHistory::ACK_LATE:
+            late_++;
+            break;
+        case SendHistory::ACK_DUPLICATE:
+            duplicates_++;
+            break;
+        case SendHistory::ACK_UNKNOWN:
+            unknown_++;
+            break;
+        default:
+            break;
+    }
+}
+
+/* human-readable summary */
+string RttStats::get_string() const
+{
+    return string_format("rtt samples %lu; min %lu us; mean %.1f us; max %lu us; srtt %.1f us; rttvar %.1f us; "
+                         "lost %lu; late %lu; duplicates %lu; unknown %lu",
+                         samples_,
+                         samples_ ? min_us_ : 0,
+                         mean_us_,
+                         max_us_,
+                         srtt_us_,
+                         rttvar_us_,
+                         lost_,
+                         late_,
+                         duplicates_,
+                         unknown_);
+}
@@ -0,0 +1,88 @@
+#ifndef UDP_SEND_HISTORY_H
+#define UDP_SEND_HISTORY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/* Send times of recent packets, shared by the sending threads (one writer per
+   sequence number) and the receiving thread (single reader) without locks. Slot i holds
+   sequence number s with s % capacity == i; a tag packs the sequence number
+   with its state so a slot reused by a newer packet is detected. */
+class SendHistory
+{
+public:
+    /* what an ack told us about its packet */
+    enum AckResult {
+        ACK_NEW,        // first ack of a packet in flight
+        ACK_LATE,       // first ack of a packet already declared lost
+        ACK_DUPLICATE,  // packet was acked before
+        ACK_UNKNOWN,    // packet never sent or already evicted from the ring
+    };
+
+    /* capacity is rounded up to a power of two */
+    explicit SendHistory(uint64_t capacity);
+
+    /* forget everything, before a new session (no other thread may use the history) */
+    void reset();
+
+    /* record a packet just before it is sent (sending thread) */
+    void on_send(uint64_t sequence_number, uint64_t send_time_us);
+
+    /* forget a packet the host failed to send, so it is not taken for path loss (sending thread) */
+    void forget(uint64_t sequence_number);
+
+    /* look up and mark the packet acked, filling in its send time (receiving thread) */
+    AckResult on_ack(uint64_t sequence_number, uint64_t &send_time_us);
+
+    /* declare unacked packets lost once an ack arrives reorder_threshold packets beyond them;
+       returns the number of newly lost packets (receiving thread) */
+    uint64_t detect_losses(uint64_t acked_sequence_number, uint64_t reorder_threshold);
+
+private:
+    static const uint64_t STATE_ACKED = uint64_t(1) << 63;
+    static const uint64_t STATE_LOST = uint64_t(1) << 62;
+    static const uint64_t SEQUENCE_MASK = STATE_LOST - 1;
+    static const uint64_t EMPTY_TAG = uint64_t(-1);
+
+    struct Slot {
+        std::atomic<uint64_t> tag;
+        std::atomic<uint64_t> send_time_us;
+    };
+
+    const uint64_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    uint64_t next_loss_check_;   // receiving thread only
+};
+
+/* running rtt statistics in microseconds */
+class RttStats
+{
+public:
+    RttStats();
+
+    /* add an rtt sample */
+    void add(uint64_t rtt_us);
+
+    /* count acks by what they told us */
+    void count(SendHistory::AckResult result);
+    void count_lost(uint64_t lost) { lost_ += lost; }
+
+    /* human-readable summary */
+    std::string get_string() const;
+
+private:
+    uint64_t samples_;
+    uint64_t min_us_;
+    uint64_t max_us_;
+    double mean_us_;
+    double srtt_us_;
+    double rttvar_us_;
+    uint64_t lost_;
+    uint64_t late_;
+    uint64_t duplicates_;
+    uint64_t unknown_;
+};
+
+#endif //UDP_SEND_HISTORY_H
@@ -6,244 +6,326 @@
 #include <csignal>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <getopt.h>
 #include <cmath>
 
 #include "packet.h"
 #include "config.h"
+#include "options.h"
+#include "congestion.h"
+#include "ack_block.h"
+#include "send_history.h"
+#include "tuning.h"
+#include "control.h"
+#include "clock_sync.h"
+#include "multi_stream.h"
+#include "pipeline.h"
 #include "timestamp.h"
 
 int listen_fd;
-struct sockaddr_in server_addr, peer_addr;
+struct sockaddr_in6 server_addr, peer_addr;
 std::ofstream log_file_handler;
 
+/* stream buffer of the packet log, sized and pre-faulted before the run */
+char log_buffer[LOG_BUFFER_LEN];
+
 int sender_thread, receiver_thread;
-int SENDER_RUNNING = true;
+std::atomic<bool> SENDER_RUNNING(true);
 uint64_t milliseconds_to_sleep, pkts_to_send, duration;
+uint64_t payload_len = PKT_PAYLOAD_LEN;
+
+/* parameters of the current session, agreed on with the client */
+SessionParams session;
+
+/* closed-loop sending (--cc): rate controller fed by acks and its state log */
+std::unique_ptr<RateController> rate_controller;
+std::ofstream cc_log_file_handler;
+
+/* send times of packets in flight, written by the sending thread and read lock-free by the receiving thread */
+SendHistory send_history(SEND_HISTORY_SLOTS);
+RttStats rtt_stats;
+uint64_t loss_reorder_threshold = LOSS_REORDER_THRESHOLD;
+
+/* SO_RXQ_OVFL counts drops over the lifetime of the socket, across daemon sessions */
+uint32_t listen_rxq_dropped = 0;
+
+/* loss, duplicates and reordering of the data received over one or more streams */
+StreamReassembly reassembly;
 
-bool DEBUG = false;
+/* offset of the peer's clock, from in-band probes, to correct one-way delays */
+ClockSync clock_sync;
 
-/* keep receiving packets and send acks (used on receiving side) */
-void recv_packets_and_send_ack(int fd);
+/* stage timestamps of sampled packets (--trace-stages), written out after the run */
+std::unique_ptr<StageTrace> stage_trace;
 
-/* use this function to send packets over a socket. */
-void *send_udp_packets(void* fd_ptr);
+/* record the effective run settings as comment lines at the top of the log */
+void write_log_header(const std::vector<std::string> &settings);
 
-/* use this function to receive packets over a socket.
-   the socket must already be connected to an address.*/
-void *recv_udp_packets(void* fd_ptr);
+/* write the stage timestamps to file_name and their summary to the log */
+void write_stage_trace(const std::string &file_name);
 
 void signalHandler(int signum) {
     shutdown(listen_fd, SHUT_RDWR);
     log_file_handler.close();
+    cc_log_file_handler.close();
     exit(signum);
 }
 
 
-int run_server(int listen_port, const char* log_file_name, double sending_rate_mbps, int time_to_run, bool downlink=true) {
-    if (downlink)
-        Log("Server -> Client");
-    else
-        Log("Client -> Server");
-
-    duration = int(time_to_run * 1000);  // in ms
-    double pkts_per_ms = sending_rate_mbps * SENDING_RATE_CONST;
-
-    if ((1.0 / SENDING_RATE_CONST) > sending_rate_mbps) {  // if sending rate < 1 pkt/ms
-        milliseconds_to_sleep = std::max(1, int(std::round(1.0 / pkts_per_ms)));
-        pkts_to_send = 1;
-    }
-    else {  // if sending rate >= 1 pkt/ms
-        milliseconds_to_sleep = 1;
-        pkts_to_send = std::max(1, int(std::round(pkts_per_ms)));
-    }
-
-    Log("sleep time %d; pkts to send %d", milliseconds_to_sleep, pkts_to_send);
-
-    // initialize signal handler and open log file
+int run_server(int listen_port, const char* log_file_name, const SessionParams *legacy) {
+    // initialize signal handler
     signal(SIGINT, signalHandler);
-    log_file_handler.open(log_file_name);
+    // a large log buffer, paged in now, keeps flushes and page faults out of the first seconds
+    memset(log_buffer, 0, sizeof(log_buffer));
+    log_file_handler.rdbuf()->pubsetbuf(log_buffer, sizeof(log_buffer));
 
     // initialize server address
-    memset(&server_addr, 0, sizeof(struct sockaddr_in));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_addr.sin_port = htons(listen_port);
+    memset(&server_addr, 0, sizeof(struct sockaddr_in6));
+    server_addr.sin6_family = AF_INET6;
+    server_addr.sin6_addr = in6addr_any;
+    server_addr.sin6_port = htons(listen_port);
 
-    // create UDP socket
-    listen_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    // create UDP socket, for IPv6 and IPv4 clients alike
+    listen_fd = dual_stack_udp_socket();
     if (listen_fd < 0) {
         Error("Cannot create socket to listen on!!!");
     }
+    set_path_mtu_discovery(listen_fd);
     set_timestamps(listen_fd);
+    set_rxq_overflow_counter(listen_fd);
+
+    // wake up receive loops regularly so they notice the end of a session
+    set_socket_timeout_ms(listen_fd, RECV_POLL_INTERVAL_MS);
+
+    // socket tuning; effective settings go to the log header
+    std::vector<std::string> settings;
+    if (run_options.busy_poll_us > 0)
+        settings.push_back(set_busy_poll(listen_fd, run_options.busy_poll_us));
+    if (run_options.spin_poll)
+        settings.push_back("spin poll: on");
+    if (run_options.rcvbuf_bytes > 0 or run_options.sndbuf_bytes > 0)
+        settings.push_back(set_socket_buffers(listen_fd, run_options.rcvbuf_bytes, run_options.sndbuf_bytes, run_options.force_buffers));
+    if (run_options.mlock)
+        settings.push_back(lock_memory(HEAP_PREFAULT_LEN));
 
     // bind to a port
     if (bind(listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0) {
         Error("Cannot bind to port %d!!", listen_port);
     }
 
-    // initialize peer address struct
-    memset(&peer_addr, '\0', sizeof(struct sockaddr_in));
-    socklen_t peer_addr_len = sizeof(peer_addr);
-
-    // wait for client to send the first message
-    Log("Waiting for the client...");
-    char* recv_data = (char*)malloc(RECV_BUFFER_LEN);
-    recvfrom(listen_fd, recv_data, RECV_BUFFER_LEN, 0, (struct sockaddr*) &peer_addr, &peer_addr_len);
-    sendto(listen_fd, "Test1_ACK\n", strlen("Test1_ACK\n"), 0, (struct sockaddr *) &peer_addr, peer_addr_len);
-    sendto(listen_fd, "Test2_ACK\n", strlen("Test2_ACK\n"), 0, (struct sockaddr *) &peer_addr, peer_addr_len);
-    recvfrom(listen_fd, recv_data, RECV_BUFFER_LEN, 0, (struct sockaddr *) &peer_addr, &peer_addr_len);
-
-    // print client address
-    char address_str[INET_ADDRSTRLEN];
-    Log("Communication established with client: %s", get_ip_str((struct sockaddr *) &peer_addr, address_str, INET_ADDRSTRLEN));
-
-    // connect socket to the client address
-    connect_socket_to_address(listen_fd, (struct sockaddr *) &peer_addr, peer_addr_len);
-    
-    if (downlink) {
-        // create two threads: one for sending packets and one for receiving
-        pthread_t send_thread, recv_thread;
-        pthread_create(&send_thread, NULL, send_udp_packets, (void*) &listen_fd);
-        pthread_create(&recv_thread, NULL, recv_udp_packets, (void*) &listen_fd);
-
-        pthread_join(send_thread, NULL);
-        Log("sender thread returned");
-        pthread_join(recv_thread, NULL);
-        Log("Recv thread returned");
-    }
-    else {
-        // start receiving packets and send acks
-        recv_packets_and_send_ack(listen_fd);
+    // worker threads are created and tuned once, then serve every session
+    TunedThread send_worker("send", run_options.send_cpu, run_options.rt_priority);
+    TunedThread recv_worker("recv", run_options.recv_cpu, run_options.rt_priority);
+    settings.push_back(send_worker.effective());
+    settings.push_back(recv_worker.effective());
+    if (run_options.trace_stages_every > 0)
+        stage_trace.reset(new StageTrace(run_options.trace_stages_every, STAGE_TRACE_SLOTS));
+
+    for (uint64_t session_count = 1; ; session_count++) {
+        // initialize peer address struct
+        memset(&peer_addr, '\0', sizeof(struct sockaddr_in6));
+        socklen_t peer_addr_len = sizeof(peer_addr);
+
+        // wait for a client and agree on the run parameters
+        Log("Waiting for the client...");
+        session = server_handshake(listen_fd, peer_addr, legacy);
+
+        // print client address
+        char address_str[INET6_ADDRSTRLEN];
+        Log("Communication established with client: %s", get_ip_str((struct sockaddr *) &peer_addr, address_str, INET6_ADDRSTRLEN));
+        Log("%s", session.get_string().c_str());
+
+        // a daemon keeps one log file per session
+        std::string session_log_name = log_file_name;
+        if (run_options.daemon) {
+            session_log_name = companion_file_name(log_file_name, string_format("%04lu", session_count));
+            Log("session %lu; log file %s", session_count, session_log_name.c_str());
+        }
+        log_file_handler.open(session_log_name);
+        if (run_options.daemon)
+            log_file_handler << "# client " << address_str << "; " << session.get_string() << "\n";
+
+        // the client chooses how the run goes
+        bool downlink = session.downlink;
+        run_options.cc_algorithm = session.cc_algorithm;
+        run_options.max_rate_mbps = session.max_rate_mbps;
+        run_options.ack_every = session.ack_every;
+        run_options.ack_interval_us = session.ack_interval_us;
+        payload_len = session.payload_len;
+
+        if (downlink)
+            Log("Server -> Client");
+        else
+            Log("Client -> Server");
+
+        duration = uint64_t(session.duration_s) * 1000;  // in ms
+        double sending_rate_mbps = session.rate_mbps;
+        double rate_const = sending_rate_const(payload_len);
+        double pkts_per_ms = sending_rate_mbps * rate_const;
+
+        if ((1.0 / rate_const) > sending_rate_mbps) {  // if sending rate < 1 pkt/ms
+            milliseconds_to_sleep = std::max(1, int(std::round(1.0 / pkts_per_ms)));
+            pkts_to_send = 1;
+        }
+        else {  // if sending rate >= 1 pkt/ms
+            milliseconds_to_sleep = 1;
+            pkts_to_send = std::max(1, int(std::round(pkts_per_ms)));
+        }
+
+        Log("sleep time %d; pkts to send %d", milliseconds_to_sleep, pkts_to_send);
+
+        // nothing carries over from the previous session
+        SENDER_RUNNING = true;
+        send_history.reset();
+        rtt_stats = RttStats();
+        rate_controller.reset();
+        clock_sync.reset(session.capabilities & CAP_CLOCK_SYNC);
+        reassembly.reset();
+        if (stage_trace)
+            stage_trace->reset();
+        loss_reorder_threshold = stream_reorder_threshold(session.streams);
+        HostDrops host_drops_at_start = get_host_drops();
+
+        // several streams: one more thread and socket per stream, for this session only
+        std::vector<std::string> session_settings = settings;
+        std::unique_ptr<StreamSenders> stream_senders;
+        if (downlink and session.streams > 1) {
+            stream_senders.reset(new StreamSenders(session.streams, run_options.send_cpu, run_options.rt_priority));
+            for (const std::string &setting : stream_senders->effective())
+                session_settings.push_back(setting);
+        }
+        write_log_header(session_settings);
+
+        // closed-loop sending: the rate controller starts at the requested rate
+        if (downlink and not run_options.cc_algorithm.empty()) {
+            rate_controller = make_rate_controller(run_options.cc_algorithm, sending_rate_mbps, run_options.max_rate_mbps);
+            cc_log_file_handler.open(companion_file_name(session_log_name, "cc"));
+            cc_log_file_handler << rate_controller->get_state_header() << "\n";
+            Log("rate controller %s; initial rate %.3f Mbps", rate_controller->name(), rate_controller->pacing_rate_mbps());
+        }
+
+        // connect socket to the client address; streams of the client come from several ports
+        if (downlink or session.streams == 1)
+            connect_socket_to_address(listen_fd, (struct sockaddr *) &peer_addr, peer_addr_len);
+
+        // the loops of this session share its state through the pipeline
+        Pipeline pipeline = {listen_fd, peer_addr, false, &session, duration, payload_len, milliseconds_to_sleep,
+                             pkts_to_send, loss_reorder_threshold, &SENDER_RUNNING, rate_controller.get(),
+                             &send_history, &rtt_stats, &clock_sync, &reassembly, &listen_rxq_dropped,
+                             stage_trace.get(), &log_file_handler, &cc_log_file_handler};
+
+        if (stream_senders) {
+            // one thread per stream for sending packets, one for receiving acks
+            recv_worker.run(recv_udp_packets, (void*) &pipeline);
+            StreamFlow flow = {listen_fd, peer_addr, duration, payload_len, sending_rate_mbps,
+                               rate_controller.get(), &send_history, stage_trace.get(), &SENDER_RUNNING};
+            send_stream_flow(pipeline, *stream_senders, flow);
+            Log("stream sender threads returned");
+            recv_worker.wait();
+            Log("Recv thread returned");
+            Log("%s", rtt_stats.get_string().c_str());
+        }
+        else if (downlink) {
+            // one thread for sending packets and one for receiving acks
+            send_worker.run(send_udp_packets, (void*) &pipeline);
+            recv_worker.run(recv_udp_packets, (void*) &pipeline);
+            send_worker.wait();
+            Log("sender thread returned");
+            recv_worker.wait();
+            Log("Recv thread returned");
+            Log("%s", rtt_stats.get_string().c_str());
+        }
+        else {
+            // receive packets and send acks
+            recv_worker.run(recv_and_ack_udp_packets, (void*) &pipeline);
+            recv_worker.wait();
+            Log("%s", reassembly.get_string().c_str());
+            log_file_handler << "# " << reassembly.get_string() << "\n";
+        }
+
+        // clock offset of the client, to correct one-way delays offline
+        Log("%s", clock_sync.get_string().c_str());
+        log_file_handler << "# " << clock_sync.get_string() << "\n";
+
+        // where the time of the sampled packets went, next to the log
+        if (stage_trace)
+            write_stage_trace(companion_file_name(session_log_name, "stages"));
+
+        // datagrams lost inside this host, to tell them apart from path loss
+        std::string host_drops = get_host_drops().since(host_drops_at_start).get_string();
+        Log("%s", host_drops.c_str());
+        log_file_handler << "# " << host_drops << "\n";
+
+        log_file_handler.close();
+        cc_log_file_handler.close();
+
+        if (not run_options.daemon)
+            break;
+
+        // accept the next client from any address
+        disconnect_socket(listen_fd);
+        Log("session %lu done", session_count);
     }
 
     shutdown(listen_fd, SHUT_RDWR);
-    log_file_handler.close();
 
     return 1;
 }
 
 int main(int argc, char** argv) {
-    if (argc == 6) {
-        int listen_port = std::atoi(argv[1]);
-        char* log_file_name = argv[2];
-        double sending_rate = std::atof(argv[3]);
-        int time_to_run = std::atoi(argv[4]);
-        bool downlink = strcmp(argv[5], "UP") == 0 ? false : true;
-        return run_server(listen_port, log_file_name, sending_rate, time_to_run, downlink);
+    // the first packets should not pay for lazy clocks and fresh stack pages
+    init_clocks();
+    prefault_stack();
+    int positional = parse_run_options(argc, argv) ? argc - optind : -1;
+    if (positional == 2 or positional == 5) {
+        char** args = argv + optind;
+        int listen_port = std::atoi(args[0]);
+        char* log_file_name = args[1];
+
+        // run parameters on the command line are only needed for clients of the old handshake
+        SessionParams legacy = {};
+        if (positional == 5) {
+            legacy.rate_mbps = std::atof(args[2]);
+            legacy.duration_s = std::atoi(args[3]);
+            legacy.downlink = strcmp(args[4], "UP") == 0 ? false : true;
+            legacy.payload_len = PKT_PAYLOAD_LEN;
+            legacy.cc_algorithm = run_options.cc_algorithm;
+            legacy.max_rate_mbps = run_options.max_rate_mbps;
+            legacy.ack_every = run_options.ack_every;
+            legacy.ack_interval_us = run_options.ack_interval_us;
+            legacy.streams = 1;
+            // the defaults and bounds of the control handshake; without capabilities acks stay per packet
+            legacy = bound_session_params(legacy);
+            // a downlink is paced here, whatever the client supports
+            legacy.cc_algorithm = run_options.cc_algorithm;
+        }
+        return run_server(listen_port, log_file_name, positional == 5 ? &legacy : NULL);
     }
     else {
+        Log("Usage: %s PORT LOG_FILE [SENDING_RATE DURATION DOWN/UP] [options]", argv[0]);
+        print_run_options_usage();
         return 0;
     }
 }
 
 
-/* keep receiving packets and send acks (used on receiving side) */
-void recv_packets_and_send_ack(int fd) {
-    int client_seq_no = 1;
-    uint64_t start_time_ms = timestamp_ms();
-
-    while (true) {
-        received_datagram message = recv_packet(fd);
-        Packet packet = message.payload;
-        if (DEBUG) {
-            Log("Custom message received ==> %d, %d, %d, %d, %d, %d, %d, %d", 
-                            packet.is_ack(), 
-                            packet.header.sequence_number, 
-                            packet.header.send_timestamp, 
-                            packet.header.ack_sequence_number, 
-                            packet.header.ack_send_timestamp, 
-                            packet.header.ack_recv_timestamp, 
-                            message.timestamp,
-                            packet.header.ack_payload_length);
-        }
-        std::string packet_info = string_format("%d, %d, %d, %d, %d, %d, %d, %d, %d\n", 
-                                                packet.is_ack(),
-                                                packet.header.sequence_number, 
-                                                packet.header.send_timestamp, 
-                                                packet.header.ack_sequence_number, 
-                                                packet.header.ack_send_timestamp, 
-                                                packet.header.ack_recv_timestamp,
-                                                message.timestamp,
-                                                packet.header.ack_payload_length,
-                                                get_current_timestamp());
-        log_file_handler << packet_info;
-        if (packet.header.sequence_number <= 0) {
-            Log("Last packet received (exiting)!");
-            break;
-        }
-        if ((timestamp_ms() - start_time_ms) >= duration) {
-            Log("Experiment duration elapsed (exiting)!");
-            break;
-        }
-        packet.transform_into_ack(client_seq_no++, message.timestamp);
-        packet.set_send_timestamp();
-        send_packet(fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), packet.to_string());
+/* record the effective run settings as comment lines at the top of the log */
+void write_log_header(const std::vector<std::string> &settings) {
+    if (not run_options.tuning_requested())
+        return;
+    for (const std::string &setting : settings) {
+        Log("%s", setting.c_str());
+        log_file_handler << "# " << setting << "\n";
     }
 }
 
-/* use this function to send packets over a socket. */
-void *send_udp_packets(void* fd_ptr)
-{
-    int server_seq_no = 1;
-    int socket_fd = *((int*) fd_ptr);
-    uint64_t start_time_ms = timestamp_ms();
-
-    int count = 0;
-    while ((timestamp_ms() - start_time_ms) <= duration and SENDER_RUNNING) {
-        while (count++ < pkts_to_send) {
-            // send packets
-            std::string message = create_packet(server_seq_no++);
-            send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-            if (DEBUG)
-                Log("Custom message sent");
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds_to_sleep));
-        count = 0;
-    }
-    std::string message = create_packet(0);
-    // send a few times just in case
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    send_packet(socket_fd, (struct sockaddr *) &peer_addr, sizeof(peer_addr), message);
-    if (DEBUG)
-        Log("Last Custom message sent");
-    SENDER_RUNNING = false;
-}
-
-/* use this function to receive packets over a socket.
-   the socket must already be connected to an address.*/
-void *recv_udp_packets(void* fd_ptr)
-{
-    int socket_fd = *((int*) fd_ptr);
-    set_socket_timeout(socket_fd, SERVER_RECV_MSG_TIMEOUT);
-
-    // recv acks and log them
-    while (SENDER_RUNNING) {
-        received_datagram recv_message = recv_packet(socket_fd); // this will exit the thread if timeout
-        Packet packet = recv_message.payload;
-        if (DEBUG) {
-                Log("Custom message received ==> %d, %d, %d, %d, %d, %d, %d, %d", 
-                            packet.is_ack(), 
-                            packet.header.sequence_number, 
-                            packet.header.send_timestamp, 
-                            packet.header.ack_sequence_number, 
-                            packet.header.ack_send_timestamp, 
-                            packet.header.ack_recv_timestamp, 
-                            recv_message.timestamp,
-                            packet.header.ack_payload_length);
-        }
-        std::string packet_info = string_format("%d, %d, %d, %d, %d, %d, %d, %d, %d\n", 
-                                                packet.is_ack(),
-                                                packet.header.sequence_number, 
-                                                packet.header.send_timestamp, 
-                                                packet.header.ack_sequence_number, 
-                                                packet.header.ack_send_timestamp, 
-                                                packet.header.ack_recv_timestamp,
-                                                recv_message.timestamp,
-                                                packet.header.ack_payload_length,
-                                                get_current_timestamp());
-        log_file_handler << packet_info;
-    }
+/* write the stage timestamps to file_name and their summary to the log */
+void write_stage_trace(const std::string &file_name) {
+    std::ofstream stage_file(file_name);
+    stage_trace->write(stage_file);
+    Log("%s; details in %s", stage_trace->get_string().c_str(), file_name.c_str());
+    log_file_handler << "# " << stage_trace->get_string() << "\n";
 }
@@ -0,0 +1,153 @@
+#include "stage_trace.h"
+#include "utils.h"
+
+#include <algorithm>
+
+using namespace std;
+
+static const uint64_t EMPTY_TAG = uint64_t(-1);
+
+/* column names, by stage */
+static const char *STAGE_NAMES[STAGE_COUNT] = {
+    "generate_ns", "send_ns", "sent_ns", "kernel_rx_ns", "user_rx_ns",
+    "ack_built_ns", "ack_sent_ns", "ack_kernel_rx_ns", "ack_user_rx_ns",
+};
+
+/* intervals summarized at the end of the run */
+struct StageInterval {
+    const char *name;
+    Stage from;
+    Stage to;
+};
+static const StageInterval INTERVALS[] = {
+    {"generate", STAGE_GENERATE, STAGE_SEND},
+    {"sendto", STAGE_SEND, STAGE_SENT},
+    {"kernel to user", STAGE_KERNEL_RX, STAGE_USER_RX},
+    {"log and ack transform", STAGE_USER_RX, STAGE_ACK_BUILT},
+    {"ack sendto", STAGE_ACK_BUILT, STAGE_ACK_SENT},
+    {"turnaround", STAGE_KERNEL_RX, STAGE_ACK_SENT},
+    {"ack kernel to user", STAGE_ACK_KERNEL_RX, STAGE_ACK_USER_RX},
+    {"send to ack", STAGE_SEND, STAGE_ACK_USER_RX},
+};
+
+/* capacity is rounded up to a power of two */
+static uint64_t round_up_to_power_of_two(const uint64_t n)
+{
+    uint64_t capacity = 1;
+    while (capacity < n) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+StageTrace::StageTrace(const uint64_t sample_every, const uint64_t capacity)
+    : sample_every_(max(uint64_t(1), sample_every)),
+    mask_(round_up_to_power_of_two(capacity) - 1),
+    slots_(new Slot[mask_ + 1])
+{
+    reset();
+}
+
+/* forget everything, before a new session (no other thread may use the trace) */
+void StageTrace::reset()
+{
+    for (uint64_t i = 0; i <= mask_; i++) {
+        slots_[i].sequence_number.store(EMPTY_TAG, memory_order_relaxed);
+        for (uint64_t stage = 0; stage < STAGE_COUNT; stage++) {
+            slots_[i].times_ns[stage].store(0, memory_order_relaxed);
+        }
+    }
+}
+
+/* record when a sampled packet reached a stage */
+void StageTrace::record(const uint64_t sequence_number, const Stage stage, const uint64_t time_ns)
+{
+    Slot &slot = slots_[(sequence_number / sample_every_) & mask_];
+
+    /* the first stage a side sees takes the slot over; later stages of an evicted packet are dropped */
+    if (slot.sequence_number.load() != sequence_number) {
+        if (stage != STAGE_GENERATE and stage != STAGE_KERNEL_RX and stage != STAGE_USER_RX) {
+            return;
+        }
+        slot.sequence_number.store(EMPTY_TAG);
+        for (uint64_t i = 0; i < STAGE_COUNT; i++) {
+            slot.times_ns[i].store(0);
+        }
+        slot.sequence_number.store(sequence_number);
+    }
+    slot.times_ns[stage].store(time_ns);
+
+    /* another thread may have taken the slot over for a newer packet meanwhile (the
+       sending thread while the receiving thread records an ack): take the time back
+       unless it was already cleared or overwritten. Sequentially consistent, so that
+       either this check sees the new tag or the takeover clears the time */
+    if (slot.sequence_number.load() != sequence_number) {
+        uint64_t written_ns = time_ns;
+        slot.times_ns[stage].compare_exchange_strong(written_ns, 0);
+    }
+}
+
+/* one CSV record per traced packet, stages the packet did not reach left empty */
+void StageTrace::write(ostream &out) const
+{
+    out << "sequence_number";
+    for (const char *name : STAGE_NAMES) {
+        out << ", " << name;
+    }
+    out << "\n";
+
+    /* oldest samples first once the ring has wrapped */
+    uint64_t newest = 0;
+    for (uint64_t i = 0; i <= mask_; i++) {
+        const uint64_t sequence_number = slots_[i].sequence_number.load();
+        if (sequence_number != EMPTY_TAG) {
+            newest = max(newest, sequence_number / sample_every_);
+        }
+    }
+    for (uint64_t n = 1; n <= mask_ + 1; n++) {
+        const Slot &slot = slots_[(newest + n) & mask_];
+        const uint64_t sequence_number = slot.sequence_number.load();
+        if (sequence_number == EMPTY_TAG) {
+            continue;
+        }
+        out << sequence_number;
+        for (const atomic<uint64_t> &time_ns : slot.times_ns) {
+            out << ", ";
+            if (time_ns.load() != 0) {
+                out << time_ns.load();
+            }
+        }
+        out << "\n";
+    }
+}
+
+/* mean time spent between stages, human-readable */
+string StageTrace::get_string() const
+{
+    uint64_t traced = 0;
+    uint64_t samples[sizeof(INTERVALS) / sizeof(INTERVALS[0])] = {};
+    double total_us[sizeof(INTERVALS) / sizeof(INTERVALS[0])] = {};
+    for (uint64_t i = 0; i <= mask_; i++) {
+        const Slot &slot = slots_[i];
+        if (slot.sequence_number.load() == EMPTY_TAG) {
+            continue;
+        }
+        traced++;
+        for (uint64_t k = 0; k < sizeof(INTERVALS) / sizeof(INTERVALS[0]); k++) {
+            const uint64_t from_ns = slot.times_ns[INTERVALS[k].from].load();
+            const uint64_t to_ns = slot.times_ns[INTERVALS[k].to].load();
+            if (from_ns != 0 and to_ns >= from_ns) {
+                samples[k]++;
+                total_us[k] += (to_ns - from_ns) / 1000.0;
+            }
+        }
+    }
+
+    string out = string_format("stages: %lu packets traced", traced);
+    for (uint64_t k = 0; k < sizeof(INTERVALS) / sizeof(INTERVALS[0]); k++) {
+        if (samples[k] > 0) {
+            out += string_format("; %s %.1f us", INTERVALS[k].name, total_us[k] / samples[k]);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,67 @@
+#ifndef UDP_STAGE_TRACE_H
+#define UDP_STAGE_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/* where a packet is on its way, in the order it gets there; the sending side
+   records the data stages and the ack's arrival, the receiving side the
+   arrival of the data and the departure of its ack */
+enum Stage : uint8_t {
+    STAGE_GENERATE,       // sending side: before create_packet
+    STAGE_SEND,           // packet built and in the send history; sendto called
+    STAGE_SENT,           // sendto returned
+    STAGE_KERNEL_RX,      // receiving side: kernel receive timestamp of the data packet
+    STAGE_USER_RX,        // data packet returned from the receive call
+    STAGE_ACK_BUILT,      // packet logged, ack transformed and serialized
+    STAGE_ACK_SENT,       // ack sendto returned
+    STAGE_ACK_KERNEL_RX,  // sending side: kernel receive timestamp of the ack
+    STAGE_ACK_USER_RX,    // ack returned from the receive call
+    STAGE_COUNT,
+};
+
+/* Stage timestamps of every k-th packet (by sequence number), in ns on the
+   realtime clock, which kernel receive timestamps use too. Slot i holds the
+   sample s with s % capacity == i; a stage is written by one thread, and
+   different stages of a packet may come from different threads. A stage
+   written while another thread takes the slot over for a newer packet is
+   taken back. The ring is read once the run is over. */
+class StageTrace
+{
+public:
+    /* trace every sample_every-th packet; capacity (samples) is rounded up to a power of two */
+    StageTrace(uint64_t sample_every, uint64_t capacity);
+
+    /* forget everything, before a new session (no other thread may use the trace) */
+    void reset();
+
+    /* is this packet traced? */
+    bool sampled(const uint64_t sequence_number) const
+    {
+        return sequence_number != 0 and sequence_number % sample_every_ == 0;
+    }
+
+    /* record when a sampled packet reached a stage */
+    void record(uint64_t sequence_number, Stage stage, uint64_t time_ns);
+
+    /* one CSV record per traced packet, stages the packet did not reach left empty */
+    void write(std::ostream &out) const;
+
+    /* mean time spent between stages, human-readable */
+    std::string get_string() const;
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence_number;
+        std::atomic<uint64_t> times_ns[STAGE_COUNT];
+    };
+
+    const uint64_t sample_every_;
+    const uint64_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+#endif //UDP_STAGE_TRACE_H
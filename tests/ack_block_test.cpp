@@ -0,0 +1,134 @@
+#include "../ack_block.h"
+#include "check.h"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* an ack block as it arrives: serialized and parsed again */
+static Packet over_the_wire(const Packet &ack)
+{
+    return Packet(ack.to_string());
+}
+
+/* an ack block with a hand-made payload */
+static Packet crafted_block(const string &payload)
+{
+    Packet ack(1, payload);
+    ack.header.ack_sequence_number = 100;
+    ack.header.ack_send_timestamp = 1000;
+    ack.header.ack_recv_timestamp = 2000;
+    ack.header.ack_payload_length = 1200;
+    return ack;
+}
+
+/* packets received out of order, with a gap, a duplicate and deltas of every sign and size */
+static void test_round_trip()
+{
+    AckAggregator aggregator(16, 0);
+    const vector<AckRecord> received = {
+        {10, 1000, 5000},
+        {12, 1003, 5002},
+        {11, 1001, 5010},                              // reordered: received after 12
+        {12, 1003, 5002},                              // duplicate
+        {15, 1000 + (uint64_t(1) << 40), 4000},        // multi-byte varint up, recv time down
+        {16, 1127, 4128},                              // large step down, then one byte boundary
+    };
+    for (const AckRecord &record : received) {
+        CHECK(aggregator.fits(record.sequence_number, 1200));
+        aggregator.add(record, 1200, 0);
+    }
+    Packet ack = over_the_wire(aggregator.make_ack(7));
+    CHECK(aggregator.empty());
+    CHECK(ack.is_ack_block());
+    CHECK(ack.header.sequence_number == 7);
+
+    const vector<AckRecord> expected = {
+        {10, 1000, 5000},
+        {11, 1001, 5010},
+        {12, 1003, 5002},
+        {15, 1000 + (uint64_t(1) << 40), 4000},
+        {16, 1127, 4128},
+    };
+    const vector<Packet> acks = expand_ack_block(ack);
+    CHECK(acks.size() == expected.size());
+    for (size_t i = 0; i < acks.size() and i < expected.size(); i++) {
+        CHECK(acks[i].is_ack());
+        CHECK(not acks[i].is_ack_block());
+        CHECK(acks[i].header.sequence_number == 7);
+        CHECK(acks[i].header.ack_sequence_number == expected[i].sequence_number);
+        CHECK(acks[i].header.ack_send_timestamp == expected[i].send_timestamp);
+        CHECK(acks[i].header.ack_recv_timestamp == expected[i].recv_timestamp);
+        CHECK(acks[i].header.ack_payload_length == 1200);
+    }
+}
+
+/* a block holds one payload length and at most ACK_BLOCK_MAX_SPAN sequence numbers */
+static void test_limits()
+{
+    AckAggregator aggregator(2, 0);
+    aggregator.add({10000, 1, 2}, 1200, 0);
+    CHECK(not aggregator.fits(10001, 600));
+    CHECK(aggregator.fits(10000 + ACK_BLOCK_MAX_SPAN - 1, 1200));
+    CHECK(not aggregator.fits(10000 + ACK_BLOCK_MAX_SPAN, 1200));
+    CHECK(aggregator.fits(10000 - ACK_BLOCK_MAX_SPAN + 1, 1200));
+    CHECK(not aggregator.fits(10000 - ACK_BLOCK_MAX_SPAN, 1200));
+    CHECK(not aggregator.full());
+
+    aggregator.add({10000 + ACK_BLOCK_MAX_SPAN - 1, 3, 4}, 1200, 0);
+    CHECK(aggregator.full());
+    CHECK(aggregator.due(0));
+    const vector<Packet> acks = expand_ack_block(over_the_wire(aggregator.make_ack(1)));
+    CHECK(acks.size() == 2);
+    CHECK(acks.size() == 2 and acks[1].header.ack_sequence_number == 10000 + ACK_BLOCK_MAX_SPAN - 1);
+    CHECK(acks.size() == 2 and acks[1].header.ack_recv_timestamp == 4);
+
+    /* a block is due by age */
+    AckAggregator timed(64, 500);
+    CHECK(not timed.due(0));
+    timed.add({1, 1, 1}, 1200, 1000);
+    CHECK(timed.time_to_flush(1200) == 300);
+    CHECK(not timed.due(1499));
+    CHECK(timed.due(1500));
+}
+
+/* garbled blocks are refused rather than read past their end */
+static void test_malformed()
+{
+    /* no span */
+    CHECK_THROWS(expand_ack_block(crafted_block("")));
+    /* span of 0 */
+    CHECK_THROWS(expand_ack_block(crafted_block(string(1, '\0'))));
+    /* span beyond ACK_BLOCK_MAX_SPAN (4097 = 0x81 0x20) */
+    CHECK_THROWS(expand_ack_block(crafted_block(string("\x81\x20", 2) + string(513, '\xff'))));
+    /* span 16 with a 1-byte bitmap */
+    CHECK_THROWS(expand_ack_block(crafted_block(string("\x10\xff", 2))));
+    /* two packets received but no timestamp deltas */
+    CHECK_THROWS(expand_ack_block(crafted_block(string("\x02\x03", 2))));
+    /* only the send delta of the second packet */
+    CHECK_THROWS(expand_ack_block(crafted_block(string("\x02\x03\x02", 3))));
+    /* a varint that never ends */
+    CHECK_THROWS(expand_ack_block(crafted_block(string(10, '\x80'))));
+    CHECK_THROWS(expand_ack_block(crafted_block(string("\x02\x03", 2) + string(10, '\xff'))));
+
+    /* the smallest valid block: the base packet alone */
+    const vector<Packet> acks = expand_ack_block(crafted_block(string("\x01\x01", 2)));
+    CHECK(acks.size() == 1);
+    CHECK(acks.size() == 1 and acks[0].header.ack_sequence_number == 100);
+    CHECK(acks.size() == 1 and acks[0].header.ack_send_timestamp == 1000);
+
+    /* a zigzag delta of -1 */
+    const vector<Packet> reordered = expand_ack_block(crafted_block(string("\x02\x03\x01\x01", 4)));
+    CHECK(reordered.size() == 2);
+    CHECK(reordered.size() == 2 and reordered[1].header.ack_send_timestamp == 999);
+    CHECK(reordered.size() == 2 and reordered[1].header.ack_recv_timestamp == 1999);
+}
+
+int main()
+{
+    test_round_trip();
+    test_limits();
+    test_malformed();
+    return check_result("ack_block_test");
+}
@@ -0,0 +1,46 @@
+#ifndef UDP_TESTS_CHECK_H
+#define UDP_TESTS_CHECK_H
+
+#include <cstdio>
+#include <stdexcept>
+
+/* Minimal checks for the wire format tests: a failed check is reported and
+   counted, and the test exits non-zero when any check failed. */
+
+static int check_failures = 0;
+
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (not (condition)) {                                                    \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            check_failures++;                                                     \
+        }                                                                         \
+    } while (0)
+
+/* the statement must throw std::runtime_error */
+#define CHECK_THROWS(statement)                                                   \
+    do {                                                                          \
+        bool thrown = false;                                                      \
+        try {                                                                     \
+            statement;                                                            \
+        } catch (const std::runtime_error &) {                                    \
+            thrown = true;                                                        \
+        }                                                                         \
+        if (not thrown) {                                                         \
+            fprintf(stderr, "%s:%d: no runtime_error from: %s\n", __FILE__, __LINE__, #statement); \
+            check_failures++;                                                     \
+        }                                                                         \
+    } while (0)
+
+/* exit status of the test */
+inline int check_result(const char *name)
+{
+    if (check_failures > 0) {
+        fprintf(stderr, "%s: %d checks failed\n", name, check_failures);
+        return 1;
+    }
+    printf("%s: all checks passed\n", name);
+    return 0;
+}
+
+#endif //UDP_TESTS_CHECK_H
@@ -0,0 +1,153 @@
+#include "../control.h"
+#include "../config.h"
+#include "check.h"
+
+#include <cmath>
+#include <string>
+
+using namespace std;
+
+static SessionParams sample_params()
+{
+    SessionParams params = SessionParams();
+    params.session_id = 0x0123456789abcdefULL;
+    params.capabilities = LOCAL_CAPABILITIES;
+    params.rate_mbps = 12.5;
+    params.duration_s = 30;
+    params.downlink = true;
+    params.payload_len = 1200;
+    params.cc_algorithm = "bbr";
+    params.max_rate_mbps = 500.0;
+    params.ack_every = 8;
+    params.ack_interval_us = 250;
+    params.streams = 4;
+    params.warmup_ms = 0;
+    return params;
+}
+
+static void check_same(const SessionParams &a, const SessionParams &b)
+{
+    CHECK(a.session_id == b.session_id);
+    CHECK(a.capabilities == b.capabilities);
+    CHECK(a.rate_mbps == b.rate_mbps);
+    CHECK(a.duration_s == b.duration_s);
+    CHECK(a.downlink == b.downlink);
+    CHECK(a.payload_len == b.payload_len);
+    CHECK(a.cc_algorithm == b.cc_algorithm);
+    CHECK(a.max_rate_mbps == b.max_rate_mbps);
+    CHECK(a.ack_every == b.ack_every);
+    CHECK(a.ack_interval_us == b.ack_interval_us);
+    CHECK(a.streams == b.streams);
+    CHECK(a.warmup_ms == b.warmup_ms);
+}
+
+/* without a warm-up the message keeps the 52-byte layout older peers know */
+static void test_round_trip()
+{
+    const SessionParams params = sample_params();
+    const string wire = ControlMessage(CONTROL_HELLO, params).to_string();
+    CHECK(wire.size() == 52);
+    CHECK(is_control_message(wire));
+    const ControlMessage parsed(wire);
+    CHECK(parsed.version == CONTROL_VERSION);
+    CHECK(parsed.type == CONTROL_HELLO);
+    check_same(parsed.params, params);
+
+    SessionParams uplink = params;
+    uplink.downlink = false;
+    uplink.cc_algorithm = "";
+    check_same(ControlMessage(ControlMessage(CONTROL_START, uplink).to_string()).params, uplink);
+}
+
+/* a warm-up length trails the parameters: 56 bytes */
+static void test_warmup()
+{
+    SessionParams params = sample_params();
+    params.warmup_ms = 2000;
+    const string wire = ControlMessage(CONTROL_HELLO_ACK, params).to_string();
+    CHECK(wire.size() == 56);
+    CHECK(is_control_message(wire));
+    const ControlMessage parsed(wire);
+    CHECK(parsed.type == CONTROL_HELLO_ACK);
+    check_same(parsed.params, params);
+
+    /* the first 52 bytes are the message an older peer would have sent */
+    CHECK(wire.compare(0, 52, ControlMessage(CONTROL_HELLO_ACK, sample_params()).to_string()) == 0);
+    CHECK(ControlMessage(wire.substr(0, 52)).params.warmup_ms == 0);
+}
+
+/* anything but 52 or 56 bytes starting with the magic is not a control message */
+static void test_truncated()
+{
+    SessionParams params = sample_params();
+    params.warmup_ms = 2000;
+    const string wire = ControlMessage(CONTROL_HELLO, params).to_string();
+    for (size_t len = 0; len < wire.size(); len++) {
+        if (len == 52) {
+            continue;
+        }
+        CHECK(not is_control_message(wire.substr(0, len)));
+        CHECK_THROWS(ControlMessage(wire.substr(0, len)));
+    }
+    CHECK(not is_control_message(wire + string(1, '\0')));
+    CHECK_THROWS(ControlMessage(wire + string(1, '\0')));
+
+    string wrong_magic = wire;
+    wrong_magic[0] ^= 0x01;
+    CHECK(not is_control_message(wrong_magic));
+    CHECK_THROWS(ControlMessage(wrong_magic.substr(0, 52)));
+}
+
+/* fields a peer cannot have meant are read as their defaults */
+static void test_unknown_fields()
+{
+    string wire = ControlMessage(CONTROL_HELLO, sample_params()).to_string();
+    wire[33] = char(0x7f);   // rate controller id
+    wire[34] = 0;            // streams, from peers that predate them
+    wire[35] = 0;
+    const ControlMessage parsed(wire);
+    CHECK(parsed.params.cc_algorithm == "");
+    CHECK(parsed.params.streams == 1);
+}
+
+/* the server carries what a client asks for only within its bounds */
+static void test_bounds()
+{
+    SessionParams params = sample_params();
+    check_same(bound_session_params(params), params);
+
+    /* no rate would leave the pacing without packets to send */
+    const double unusable_rates[] = {0.0, -1.0, NAN};
+    for (double rate_mbps : unusable_rates) {
+        params.rate_mbps = rate_mbps;
+        CHECK(bound_session_params(params).rate_mbps == CC_MIN_RATE_MBPS);
+    }
+    params.rate_mbps = 2 * MAX_SESSION_RATE_MBPS;
+    CHECK(bound_session_params(params).rate_mbps == MAX_SESSION_RATE_MBPS);
+
+    params.max_rate_mbps = 0.0;
+    CHECK(bound_session_params(params).max_rate_mbps == MAX_SESSION_RATE_MBPS);
+    params.duration_s = MAX_SESSION_DURATION_S + 1;
+    CHECK(bound_session_params(params).duration_s == MAX_SESSION_DURATION_S);
+    params.streams = 0;
+    CHECK(bound_session_params(params).streams == 1);
+    params.ack_interval_us = ACK_INTERVAL_MAX_US + 1;
+    CHECK(bound_session_params(params).ack_interval_us == ACK_INTERVAL_MAX_US);
+
+    /* a client without ack blocks or rate control gets neither */
+    params.capabilities = 0;
+    const SessionParams bounded = bound_session_params(params);
+    CHECK(bounded.ack_every == 1);
+    CHECK(bounded.ack_interval_us == 0);
+    CHECK(bounded.cc_algorithm == "");
+}
+
+int main()
+{
+    test_round_trip();
+    test_warmup();
+    test_truncated();
+    test_unknown_fields();
+    test_bounds();
+    return check_result("control_test");
+}
@@ -27,13 +27,54 @@ uint64_t timestamp_ms()
     return timestamp_ms(current_time());
 }
 
-uint64_t timestamp_ms(const timespec &ts)
+/* start of the program on the realtime clock, in milliseconds */
+static uint64_t epoch_ms()
 {
     const static uint64_t EPOCH = timestamp_ms_raw(current_time());
-    return timestamp_ms_raw(ts) - EPOCH;
+    return EPOCH;
+}
+
+uint64_t timestamp_ms(const timespec &ts)
+{
+    return timestamp_ms_raw(ts) - epoch_ms();
+}
+
+/* current time in microseconds since the start of the program, on the clock of timestamp_ms() */
+uint64_t log_timestamp_us()
+{
+    const timespec ts = current_time();
+    return ts.tv_sec * MILLION + ts.tv_nsec / 1000 - epoch_ms() * 1000;
+}
+
+/* monotonic time in microseconds, for timers within one process */
+uint64_t timestamp_us()
+{
+    timespec ts{};
+    SystemCall("clock_gettime", clock_gettime(CLOCK_MONOTONIC, &ts));
+    return ts.tv_sec * MILLION + ts.tv_nsec / 1000;
+}
+
+/* realtime clock in nanoseconds, the clock of kernel receive timestamps */
+uint64_t realtime_ns()
+{
+    return realtime_ns(current_time());
+}
+
+uint64_t realtime_ns(const timespec &ts)
+{
+    return ts.tv_sec * BILLION + ts.tv_nsec;
 }
 
 uint64_t get_current_timestamp()
 {
     return timestamp_ms_raw(current_time());
 }
+
+/* read every clock once and fix the start of the program, so the first
+   packet does not pay for it; call early in main() */
+void init_clocks()
+{
+    epoch_ms();
+    timestamp_us();
+    log_timestamp_us();
+}
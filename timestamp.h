@@ -9,4 +9,18 @@ uint64_t get_current_timestamp();
 uint64_t timestamp_ms();
 uint64_t timestamp_ms(const timespec &ts);
 
+/* current time in microseconds since the start of the program, on the clock of timestamp_ms() */
+uint64_t log_timestamp_us();
+
+/* monotonic time in microseconds, for timers within one process */
+uint64_t timestamp_us();
+
+/* realtime clock in nanoseconds, the clock of kernel receive timestamps */
+uint64_t realtime_ns();
+uint64_t realtime_ns(const timespec &ts);
+
+/* read every clock once and fix the start of the program, so the first
+   packet does not pay for it; call early in main() */
+void init_clocks();
+
 #endif //UDP_TIMESTAMP_H
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "tuning.h"
+#include "utils.h"
+#include "config.h"
+
+#include <cstdlib>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+/* pin the calling thread to a cpu (-1 = anywhere) and run it under SCHED_FIFO
+   at rt_priority (0 = default scheduling). Settings that cannot be applied are
+   reported and skipped; returns a description of the effective settings */
+string tune_current_thread(const char *role, const int cpu, const int rt_priority)
+{
+    string cpu_setting = "any";
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err == 0) {
+            cpu_setting = to_string(cpu);
+        } else {
+            Log("%s thread: cannot pin to cpu %d: %s", role, cpu, strerror(err));
+        }
+    }
+
+    string sched_setting = "SCHED_OTHER";
+    if (rt_priority > 0) {
+        sched_param param{};
+        param.sched_priority = rt_priority;
+        const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err == 0) {
+            sched_setting = string_format("SCHED_FIFO %d", rt_priority);
+        } else {
+            Log("%s thread: cannot use SCHED_FIFO %d: %s", role, rt_priority, strerror(err));
+        }
+    }
+
+    return string_format("%s thread: cpu %s, %s", role, cpu_setting.c_str(), sched_setting.c_str());
+}
+
+/* enable kernel busy polling on a socket for up to busy_poll_us per receive;
+   returns a description of the effective settings */
+string set_busy_poll(const int fd, const int busy_poll_us)
+{
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) != 0) {
+        Log("cannot set SO_BUSY_POLL: %s", strerror(errno));
+        return "busy poll: off";
+    }
+    const int prefer = true;
+    const bool preferred = setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) == 0;
+    if (not preferred) {
+        Log("cannot set SO_PREFER_BUSY_POLL: %s", strerror(errno));
+    }
+    return string_format("busy poll: %d us, prefer busy poll %s", busy_poll_us, preferred ? "on" : "off");
+}
+
+/* set one socket buffer, returning the size the kernel reports */
+static int set_socket_buffer(const int fd, const char *name, const int option, const int force_option,
+                             const int bytes, const bool force)
+{
+    if (bytes > 0) {
+        if (not force or setsockopt(fd, SOL_SOCKET, force_option, &bytes, sizeof(bytes)) != 0) {
+            if (force) {
+                Log("cannot force %s: %s", name, strerror(errno));
+            }
+            if (setsockopt(fd, SOL_SOCKET, option, &bytes, sizeof(bytes)) != 0) {
+                Log("cannot set %s: %s", name, strerror(errno));
+            }
+        }
+    }
+    int effective = 0;
+    socklen_t len = sizeof(effective);
+    SystemCall("getsockopt", getsockopt(fd, SOL_SOCKET, option, &effective, &len));
+    if (bytes > 0 and effective < bytes) {
+        Log("%s capped at %d bytes (requested %d)", name, effective, bytes);
+    }
+    return effective;
+}
+
+/* size the socket buffers (0 = kernel default); with force, try SO_RCVBUFFORCE /
+   SO_SNDBUFFORCE first to exceed net.core.[rw]mem_max. returns a description of
+   the effective sizes as reported by the kernel */
+string set_socket_buffers(const int fd, const int rcvbuf_bytes, const int sndbuf_bytes, const bool force)
+{
+    const int rcvbuf = set_socket_buffer(fd, "SO_RCVBUF", SO_RCVBUF, SO_RCVBUFFORCE, rcvbuf_bytes, force);
+    const int sndbuf = set_socket_buffer(fd, "SO_SNDBUF", SO_SNDBUF, SO_SNDBUFFORCE, sndbuf_bytes, force);
+    return string_format("socket buffers: rcvbuf %d bytes, sndbuf %d bytes", rcvbuf, sndbuf);
+}
+
+/* touch the stack pages the calling thread is about to use, so its first
+   packets do not take page faults */
+__attribute__((noinline)) void prefault_stack()
+{
+    volatile char stack[STACK_PREFAULT_LEN];
+    const size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < sizeof(stack); i += page) {
+        stack[i] = 0;
+    }
+}
+
+/* lock the pages of the process in memory (mlockall) and keep freed heap
+   instead of returning it to the kernel, after pre-faulting heap_bytes of it.
+   Settings that cannot be applied are reported and skipped; returns a
+   description of the effective settings */
+string lock_memory(const size_t heap_bytes)
+{
+    // freed memory stays in the heap, and large blocks come from it rather than from fresh mmaps
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    char *heap = static_cast<char*>(malloc(heap_bytes));
+    if (heap != NULL) {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < heap_bytes; i += page) {
+            heap[i] = 0;
+        }
+    }
+    free(heap);
+
+    // with a memlock limit, locking future mappings would make thread stacks and sockets fail later
+    rlimit limit{};
+    const bool unlimited = geteuid() == 0 or
+                           (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 and limit.rlim_cur == RLIM_INFINITY);
+    const int flags = unlimited ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT;
+    if (mlockall(flags) != 0) {
+        Log("cannot lock memory: %s", strerror(errno));
+        return string_format("memory: heap %lu MB pre-faulted, not locked", heap_bytes >> 20);
+    }
+    return string_format("memory: heap %lu MB pre-faulted, locked (%s)", heap_bytes >> 20,
+                         unlimited ? "current and future pages" : "current pages");
+}
+
+/* start the thread; returns once it has tuned itself */
+TunedThread::TunedThread(const char *role, const int cpu, const int rt_priority)
+    : role_(role),
+    cpu_(cpu),
+    rt_priority_(rt_priority),
+    effective_(),
+    thread_(),
+    lock_(),
+    changed_(),
+    tuned_(false),
+    stopping_(false),
+    alive_(true),
+    routine_(NULL),
+    arg_(NULL)
+{
+    const int err = pthread_create(&thread_, NULL, thread_main, this);
+    if (err != 0) {
+        throw unix_error("pthread_create", err);
+    }
+    unique_lock<mutex> guard(lock_);
+    changed_.wait(guard, [&] { return tuned_; });
+}
+
+/* wait for the current job and join the thread */
+TunedThread::~TunedThread()
+{
+    {
+        unique_lock<mutex> guard(lock_);
+        changed_.wait(guard, [&] { return routine_ == NULL or not alive_; });
+        stopping_ = true;
+        changed_.notify_all();
+    }
+    pthread_join(thread_, NULL);
+}
+
+/* hand the thread a job; the previous one must have finished */
+void TunedThread::run(void *(*routine)(void *), void *arg)
+{
+    unique_lock<mutex> guard(lock_);
+    if (not alive_) {
+        Error("%s thread is gone", role_);
+    }
+    routine_ = routine;
+    arg_ = arg;
+    changed_.notify_all();
+}
+
+/* wait until the current job has finished */
+void TunedThread::wait()
+{
+    unique_lock<mutex> guard(lock_);
+    changed_.wait(guard, [&] { return routine_ == NULL or not alive_; });
+}
+
+void *TunedThread::thread_main(void *self)
+{
+    static_cast<TunedThread*>(self)->serve();
+    return NULL;
+}
+
+/* marks the thread gone if a job ends it with pthread_exit */
+struct ThreadExitGuard {
+    bool *alive;
+    mutex *lock;
+    condition_variable *changed;
+    ~ThreadExitGuard()
+    {
+        lock_guard<mutex> guard(*lock);
+        *alive = false;
+        changed->notify_all();
+    }
+};
+
+void TunedThread::serve()
+{
+    prefault_stack();
+    {
+        const string effective = tune_current_thread(role_, cpu_, rt_priority_);
+        lock_guard<mutex> guard(lock_);
+        effective_ = effective;
+        tuned_ = true;
+        changed_.notify_all();
+    }
+
+    ThreadExitGuard exit_guard = {&alive_, &lock_, &changed_};
+    while (true) {
+        void *(*routine)(void *);
+        void *arg;
+        {
+            unique_lock<mutex> guard(lock_);
+            changed_.wait(guard, [&] { return routine_ != NULL or stopping_; });
+            if (routine_ == NULL) {
+                return;
+            }
+            routine = routine_;
+            arg = arg_;
+        }
+
+        routine(arg);
+
+        lock_guard<mutex> guard(lock_);
+        routine_ = NULL;
+        changed_.notify_all();
+    }
+}
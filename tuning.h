@@ -0,0 +1,75 @@
+#ifndef UDP_TUNING_H
+#define UDP_TUNING_H
+
+#include <condition_variable>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+
+/* pin the calling thread to a cpu (-1 = anywhere) and run it under SCHED_FIFO
+   at rt_priority (0 = default scheduling). Settings that cannot be applied are
+   reported and skipped; returns a description of the effective settings */
+std::string tune_current_thread(const char *role, int cpu, int rt_priority);
+
+/* enable kernel busy polling on a socket for up to busy_poll_us per receive;
+   returns a description of the effective settings */
+std::string set_busy_poll(int fd, int busy_poll_us);
+
+/* size the socket buffers (0 = kernel default); with force, try SO_RCVBUFFORCE /
+   SO_SNDBUFFORCE first to exceed net.core.[rw]mem_max. returns a description of
+   the effective sizes as reported by the kernel */
+std::string set_socket_buffers(int fd, int rcvbuf_bytes, int sndbuf_bytes, bool force);
+
+/* touch the stack pages the calling thread is about to use, so its first
+   packets do not take page faults */
+void prefault_stack();
+
+/* lock the pages of the process in memory (mlockall) and keep freed heap
+   instead of returning it to the kernel, after pre-faulting heap_bytes of it.
+   Settings that cannot be applied are reported and skipped; returns a
+   description of the effective settings */
+std::string lock_memory(size_t heap_bytes);
+
+/* A thread that tunes itself once when it starts and then runs one job at a
+   time, parking in between, so the same thread can serve successive sessions */
+class TunedThread
+{
+public:
+    /* start the thread; returns once it has tuned itself */
+    TunedThread(const char *role, int cpu, int rt_priority);
+
+    /* wait for the current job and join the thread */
+    ~TunedThread();
+
+    TunedThread(const TunedThread &) = delete;
+    TunedThread &operator=(const TunedThread &) = delete;
+
+    /* description of the settings the thread runs with */
+    const std::string &effective() const { return effective_; }
+
+    /* hand the thread a job; the previous one must have finished */
+    void run(void *(*routine)(void *), void *arg);
+
+    /* wait until the current job has finished */
+    void wait();
+
+private:
+    static void *thread_main(void *self);
+    void serve();
+
+    const char *role_;
+    const int cpu_;
+    const int rt_priority_;
+    std::string effective_;
+
+    pthread_t thread_;
+    std::mutex lock_;
+    std::condition_variable changed_;
+    bool tuned_;
+    bool stopping_;
+    bool alive_;
+    void *(*routine_)(void *);
+    void *arg_;
+};
+
+#endif //UDP_TUNING_H
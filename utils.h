@@ -9,6 +9,8 @@
 #include <stdarg.h>
 #include <memory>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
 #include <system_error>
 
 /* tagged_error: system_error + name of what was being attempted */
@@ -94,8 +96,13 @@ inline char *get_ip_str(const struct sockaddr *sa, char *s, size_t maxlen)
             break;
 
         case AF_INET6:
-            inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)sa)->sin6_addr),
-                    s, maxlen);
+            /* IPv4 peers of a dual-stack socket show as ::ffff:a.b.c.d; print a.b.c.d */
+            if (IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *)sa)->sin6_addr))
+                inet_ntop(AF_INET, &((struct sockaddr_in6 *)sa)->sin6_addr.s6_addr[12],
+                        s, maxlen);
+            else
+                inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)sa)->sin6_addr),
+                        s, maxlen);
             break;
 
         default:
@@ -124,12 +131,88 @@ inline void set_timestamps(const int fd)
     setsocketopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, int (true));
 }
 
+/* count datagrams dropped by the receive queue (reported with each datagram) */
+inline void set_rxq_overflow_counter(const int fd)
+{
+    setsocketopt(fd, SOL_SOCKET, SO_RXQ_OVFL, int (true));
+}
+
+/* UDP socket for IPv6 and IPv4 peers alike; IPv4 addresses appear v4-mapped (::ffff:a.b.c.d) */
+inline int dual_stack_udp_socket()
+{
+    const int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd >= 0) {
+        setsocketopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, int(false));
+    }
+    return fd;
+}
+
+/* resolve host (an IPv4 or IPv6 address, or a name) and port for a dual-stack socket;
+   returns false if it does not resolve */
+inline bool resolve_address(const char *host, const int port, struct sockaddr_in6 &address)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_V4MAPPED;
+    struct addrinfo *result = NULL;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0 or result == NULL) {
+        return false;
+    }
+    memcpy(&address, result->ai_addr, sizeof(address));
+    address.sin6_port = htons(port);
+    freeaddrinfo(result);
+    return true;
+}
+
+/* is the address an IPv4 address on a dual-stack socket? */
+inline bool is_ipv4_address(const struct sockaddr_in6 &address)
+{
+    return IN6_IS_ADDR_V4MAPPED(&address.sin6_addr);
+}
+
+/* do two addresses belong to the same host (any port)? */
+inline bool same_host(const struct sockaddr_in6 &a, const struct sockaddr_in6 &b)
+{
+    return memcmp(&a.sin6_addr, &b.sin6_addr, sizeof(a.sin6_addr)) == 0;
+}
+
+/* never fragment outgoing datagrams, for IPv6 and v4-mapped IPv4 peers (sends
+   beyond the path MTU fail with EMSGSIZE instead) */
+inline void set_path_mtu_discovery(const int fd)
+{
+    setsocketopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, int(IPV6_PMTUDISC_DO));
+    setsocketopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, int(IP_PMTUDISC_DO));
+}
+
+/* path MTU known for the peer of a connected socket, or -1 */
+inline int path_mtu(const int fd)
+{
+    int mtu = -1;
+    socklen_t mtu_len = sizeof(mtu);
+    if (getsockopt(fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &mtu_len) != 0) {
+        return -1;
+    }
+    return mtu;
+}
+
 /* connect socket to a specified peer address */
 inline void connect_socket_to_address(const int fd, const struct sockaddr *sa, socklen_t len)
 {
     SystemCall("connect", connect(fd, sa, len));
 }
 
+/* dissolve the association made by connect_socket_to_address, so the socket
+   receives from any address again */
+inline void disconnect_socket(const int fd)
+{
+    struct sockaddr unspec;
+    memset(&unspec, 0, sizeof(unspec));
+    unspec.sa_family = AF_UNSPEC;
+    SystemCall("connect", connect(fd, &unspec, sizeof(unspec)));
+}
+
 /* set socket timeout for receiving packets */
 inline void set_socket_timeout(const int fd, uint64_t timeout_in_seconds) 
 {
@@ -139,6 +222,23 @@ inline void set_socket_timeout(const int fd, uint64_t timeout_in_seconds)
     setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv);
 }
 
+/* set socket timeout for receiving packets, in milliseconds */
+inline void set_socket_timeout_ms(const int fd, uint64_t timeout_ms)
+{
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv);
+}
+
+/* wait until the socket is readable; returns false on timeout */
+inline bool wait_readable(const int fd, uint64_t timeout_us)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    struct timespec timeout = {time_t(timeout_us / 1000000), long(timeout_us % 1000000) * 1000};
+    return SystemCall("ppoll", ppoll(&pfd, 1, &timeout, NULL)) > 0;
+}
+
 /* use this function to get a formatted string like C */
 inline std::string string_format(const std::string fmt_str, ...) {
     int final_n, n = ((int)fmt_str.size()) * 2; /* Reserve two times as much as the length of the fmt_str */
@@ -158,4 +258,15 @@ inline std::string string_format(const std::string fmt_str, ...) {
     return std::string(formatted.get());
 }
 
+/* name of a companion file to a log, e.g. ("run1.csv", "cc") -> "run1-cc.csv" */
+inline std::string companion_file_name(const std::string &log_file_name, const std::string &tag)
+{
+    const std::string extension = ".csv";
+    std::string base = log_file_name;
+    if (base.size() > extension.size() and base.compare(base.size() - extension.size(), extension.size(), extension) == 0) {
+        base.erase(base.size() - extension.size());
+    }
+    return base + "-" + tag + extension;
+}
+
 #endif //UDP_UTILS_H
\ No newline at end of file
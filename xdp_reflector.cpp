@@ -0,0 +1,542 @@
+#include "xdp_reflector.h"
+#include "config.h"
+#include "options.h"
+#include "timestamp.h"
+#include "utils.h"
+
+#include <stdexcept>
+
+#ifdef HAVE_AF_XDP
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+using namespace std;
+
+/* ethernet header; ipv4 without options and udp follow */
+static const size_t ETH_HEADER_LEN = 14;
+static const size_t HEADERS_LEN = ETH_HEADER_LEN + IPV4_HEADER_LEN + UDP_HEADER_LEN;
+
+static const uint64_t NO_FRAME = -1;
+
+static int bpf(const int cmd, union bpf_attr &attr)
+{
+    return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+static bpf_insn instruction(const uint8_t code, const uint8_t dst, const uint8_t src, const int16_t off, const int32_t imm)
+{
+    bpf_insn insn;
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+
+/* ones' complement checksum of an ip header */
+static uint16_t ip_checksum(const uint8_t *header)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < IPV4_HEADER_LEN; i += 2) {
+        sum += (header[i] << 8) | header[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons(~sum & 0xffff);
+}
+
+static void put_be16(uint8_t *at, const uint16_t n)
+{
+    at[0] = n >> 8;
+    at[1] = n & 0xff;
+}
+
+static uint16_t get_be16(const uint8_t *at)
+{
+    return (at[0] << 8) | at[1];
+}
+
+/* attach to a queue of ifname for the datagrams to the port fd is bound to;
+   acks go to peer. Throws when AF_XDP cannot be set up */
+XdpReflector::XdpReflector(const int fd, const struct sockaddr_in6 &peer, const string &ifname,
+                           const uint32_t queue, const bool native)
+    : fd_(fd),
+    peer_(peer),
+    mode_(),
+    xsk_(-1),
+    umem_(NULL),
+    fill_(),
+    completion_(),
+    rx_(),
+    tx_(),
+    free_frames_(),
+    map_fd_(-1),
+    prog_fd_(-1),
+    link_fd_(-1),
+    socket_turn_(0),
+    current_(NO_FRAME),
+    reply_headers_(),
+    reply_headers_valid_(false),
+    rx_packets_(0),
+    socket_rx_packets_(0),
+    tx_packets_(0),
+    tx_dropped_(0)
+{
+    const int ifindex = if_nametoindex(ifname.c_str());
+    if (ifindex == 0) {
+        throw unix_error("if_nametoindex " + ifname);
+    }
+    if (not is_ipv4_address(peer)) {
+        throw runtime_error("AF_XDP path handles IPv4 peers only");
+    }
+    struct sockaddr_in6 local{};
+    socklen_t local_len = sizeof(local);
+    SystemCall("getsockname", getsockname(fd, (struct sockaddr *) &local, &local_len));
+
+    try {
+        /* UMEM: frames shared with the kernel */
+        const size_t umem_len = XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+        void *umem = mmap(NULL, umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (umem == MAP_FAILED) {
+            throw unix_error("mmap umem");
+        }
+        umem_ = static_cast<uint8_t*>(umem);
+
+        xsk_ = SystemCall("socket AF_XDP", socket(AF_XDP, SOCK_RAW, 0));
+        struct xdp_umem_reg reg{};
+        reg.addr = uint64_t(umem_);
+        reg.len = umem_len;
+        reg.chunk_size = XDP_FRAME_SIZE;
+        reg.headroom = 0;
+        SystemCall("XDP_UMEM_REG", setsockopt(xsk_, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)));
+
+        const int ring_size = XDP_RING_SIZE;
+        SystemCall("XDP_UMEM_FILL_RING", setsockopt(xsk_, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)));
+        SystemCall("XDP_UMEM_COMPLETION_RING", setsockopt(xsk_, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)));
+        SystemCall("XDP_RX_RING", setsockopt(xsk_, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)));
+        SystemCall("XDP_TX_RING", setsockopt(xsk_, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)));
+
+        struct xdp_mmap_offsets off{};
+        socklen_t off_len = sizeof(off);
+        SystemCall("XDP_MMAP_OFFSETS", getsockopt(xsk_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len));
+        map_ring(fill_, XDP_UMEM_PGOFF_FILL_RING, off.fr.desc, off.fr.producer, off.fr.consumer, sizeof(uint64_t));
+        map_ring(completion_, XDP_UMEM_PGOFF_COMPLETION_RING, off.cr.desc, off.cr.producer, off.cr.consumer, sizeof(uint64_t));
+        map_ring(rx_, XDP_PGOFF_RX_RING, off.rx.desc, off.rx.producer, off.rx.consumer, sizeof(struct xdp_desc));
+        map_ring(tx_, XDP_PGOFF_TX_RING, off.tx.desc, off.tx.producer, off.tx.consumer, sizeof(struct xdp_desc));
+
+        /* half of the frames wait for datagrams, the others for acks */
+        for (uint64_t i = XDP_NUM_FRAMES; i > 0; i--) {
+            free_frames_.push_back((i - 1) * XDP_FRAME_SIZE);
+        }
+        refill();
+
+        struct sockaddr_xdp address{};
+        address.sxdp_family = AF_XDP;
+        address.sxdp_ifindex = ifindex;
+        address.sxdp_queue_id = queue;
+        address.sxdp_flags = native ? XDP_ZEROCOPY : XDP_COPY;
+        bool zero_copy = native;
+        if (bind(xsk_, (struct sockaddr *) &address, sizeof(address)) != 0) {
+            if (not native) {
+                throw unix_error("bind AF_XDP");
+            }
+            address.sxdp_flags = XDP_COPY;
+            zero_copy = false;
+            SystemCall("bind AF_XDP", bind(xsk_, (struct sockaddr *) &address, sizeof(address)));
+        }
+
+        attach_program(ifindex, queue, ntohs(local.sin6_port), native);
+        mode_ = string_format("AF_XDP on %s queue %u, %s mode, %s", ifname.c_str(), queue,
+                              native ? "native" : "generic", zero_copy ? "zero-copy" : "copy");
+    } catch (...) {
+        release();
+        throw;
+    }
+}
+
+/* detach the program and release the UMEM */
+XdpReflector::~XdpReflector()
+{
+    release();
+}
+
+void XdpReflector::release()
+{
+    /* closing the link detaches the program */
+    for (int *fd : {&link_fd_, &prog_fd_, &map_fd_, &xsk_}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    for (Ring *ring : {&fill_, &completion_, &rx_, &tx_}) {
+        if (ring->map) {
+            munmap(ring->map, ring->map_len);
+            ring->map = NULL;
+        }
+    }
+    if (umem_) {
+        munmap(umem_, XDP_NUM_FRAMES * XDP_FRAME_SIZE);
+        umem_ = NULL;
+    }
+}
+
+void XdpReflector::map_ring(Ring &ring, const uint64_t pgoff, const uint64_t desc_offset, const uint64_t producer_offset,
+                            const uint64_t consumer_offset, const size_t desc_size)
+{
+    ring.map_len = desc_offset + XDP_RING_SIZE * desc_size;
+    ring.map = mmap(NULL, ring.map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xsk_, pgoff);
+    if (ring.map == MAP_FAILED) {
+        ring.map = NULL;
+        throw unix_error("mmap AF_XDP ring");
+    }
+    uint8_t *base = static_cast<uint8_t*>(ring.map);
+    ring.producer = reinterpret_cast<uint32_t*>(base + producer_offset);
+    ring.consumer = reinterpret_cast<uint32_t*>(base + consumer_offset);
+    ring.descs = base + desc_offset;
+}
+
+/* XDP program: hand ipv4 udp datagrams to our port to the socket of the
+   receive queue (XDP_PASS if it has none), pass everything else */
+void XdpReflector::attach_program(const int ifindex, const uint32_t queue, const uint16_t port, const bool native)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = queue + 1;
+    map_fd_ = SystemCall("bpf map create", bpf(BPF_MAP_CREATE, attr));
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd_;
+    attr.key = uint64_t(&queue);
+    attr.value = uint64_t(&xsk_);
+    SystemCall("bpf map update", bpf(BPF_MAP_UPDATE_ELEM, attr));
+
+    const int16_t PASS = 20;
+    vector<bpf_insn> program = {
+        instruction(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+        instruction(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0),
+        instruction(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0),
+        instruction(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        instruction(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, HEADERS_LEN),
+        instruction(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, PASS - 6, 0),
+        instruction(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, 12, 0),                  // ethertype
+        instruction(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, PASS - 8, htons(0x0800)),
+        instruction(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, ETH_HEADER_LEN, 0),      // version, header length
+        instruction(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, PASS - 10, 0x45),
+        instruction(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, ETH_HEADER_LEN + 9, 0),  // protocol
+        instruction(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, PASS - 12, IPPROTO_UDP),
+        instruction(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, ETH_HEADER_LEN + IPV4_HEADER_LEN + 2, 0),  // dst port
+        instruction(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, PASS - 14, htons(port)),
+        instruction(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd_),
+        instruction(0, 0, 0, 0, 0),
+        instruction(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0),
+        instruction(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+        instruction(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        instruction(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),                   // PASS
+        instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+
+    static char verifier_log[16384];
+    verifier_log[0] = '\0';
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = uint64_t(program.data());
+    attr.insn_cnt = program.size();
+    attr.license = uint64_t("GPL");
+    attr.log_buf = uint64_t(verifier_log);
+    attr.log_size = sizeof(verifier_log);
+    attr.log_level = 1;
+    prog_fd_ = bpf(BPF_PROG_LOAD, attr);
+    if (prog_fd_ < 0) {
+        const int err = errno;
+        Log("%s", verifier_log);
+        throw unix_error("bpf prog load", err);
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = prog_fd_;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = native ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+    link_fd_ = SystemCall("bpf link create", bpf(BPF_LINK_CREATE, attr));
+}
+
+/* keep the fill ring stocked, holding back a few frames for acks */
+void XdpReflector::refill()
+{
+    const uint32_t consumer = __atomic_load_n(fill_.consumer, __ATOMIC_ACQUIRE);
+    uint32_t producer = *fill_.producer;
+    uint64_t *descs = static_cast<uint64_t*>(fill_.descs);
+    while (producer - consumer < XDP_RING_SIZE and free_frames_.size() > XDP_TX_RESERVE) {
+        descs[producer & (XDP_RING_SIZE - 1)] = free_frames_.back();
+        free_frames_.pop_back();
+        producer++;
+    }
+    __atomic_store_n(fill_.producer, producer, __ATOMIC_RELEASE);
+}
+
+/* frames of transmitted acks are free again */
+void XdpReflector::reclaim_completions()
+{
+    const uint32_t producer = __atomic_load_n(completion_.producer, __ATOMIC_ACQUIRE);
+    uint32_t consumer = *completion_.consumer;
+    const uint64_t *descs = static_cast<const uint64_t*>(completion_.descs);
+    for (; consumer != producer; consumer++) {
+        const uint64_t addr = descs[consumer & (XDP_RING_SIZE - 1)];
+        free_frames_.push_back(addr - addr % XDP_FRAME_SIZE);
+    }
+    __atomic_store_n(completion_.consumer, consumer, __ATOMIC_RELEASE);
+}
+
+/* the last datagram was not answered in place: its frame can take the next one */
+void XdpReflector::release_current()
+{
+    if (current_ != NO_FRAME) {
+        free_frames_.push_back(current_ - current_ % XDP_FRAME_SIZE);
+        current_ = NO_FRAME;
+    }
+}
+
+/* wait until the AF_XDP socket or the UDP socket is readable; returns false on timeout */
+static bool wait_either_readable(const int xsk, const int fd, const uint64_t timeout_us)
+{
+    struct pollfd pfds[2] = {{xsk, POLLIN, 0}, {fd, POLLIN, 0}};
+    struct timespec timeout = {time_t(timeout_us / 1000000), long(timeout_us % 1000000) * 1000};
+    return SystemCall("ppoll", ppoll(pfds, 2, &timeout, NULL)) > 0;
+}
+
+/* wait until a datagram is ready; returns false on timeout */
+bool XdpReflector::wait_readable(const uint64_t timeout_us)
+{
+    if (__atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE) != *rx_.consumer) {
+        return true;
+    }
+    return wait_either_readable(xsk_, fd_, timeout_us);
+}
+
+/* next datagram (no kernel receive timestamp), which stays in its
+   frame until the next call (an empty payload means the timeout
+   expired); with spin, poll without sleeping */
+received_datagram XdpReflector::receive(const uint64_t timeout_ms, const bool spin)
+{
+    release_current();
+    reclaim_completions();
+    refill();
+
+    /* datagrams the program does not take (other queues, before the attach) arrive on the
+       socket: look there whenever the ring is empty, and now and then while it is busy */
+    const bool ring_empty = __atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE) == *rx_.consumer;
+    if (ring_empty or ++socket_turn_ >= XDP_SOCKET_CHECK_EVERY) {
+        socket_turn_ = 0;
+        if (::wait_readable(fd_, 0)) {
+            socket_rx_packets_++;
+            return recv_packet(fd_, true);
+        }
+    }
+
+    received_datagram datagram = {peer_, uint64_t(-1), 0, string(), 0};
+    const uint64_t deadline_us = timestamp_us() + timeout_ms * 1000;
+    while (__atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE) == *rx_.consumer) {
+        const uint64_t now_us = timestamp_us();
+        if (now_us >= deadline_us) {
+            return datagram;
+        }
+        if (not spin) {
+            wait_either_readable(xsk_, fd_, deadline_us - now_us);
+        }
+        if (::wait_readable(fd_, 0)) {
+            socket_rx_packets_++;
+            return recv_packet(fd_, true);
+        }
+    }
+
+    const uint32_t consumer = *rx_.consumer;
+    const struct xdp_desc desc = static_cast<const struct xdp_desc*>(rx_.descs)[consumer & (XDP_RING_SIZE - 1)];
+    __atomic_store_n(rx_.consumer, consumer + 1, __ATOMIC_RELEASE);
+    current_ = desc.addr;
+    rx_packets_++;
+
+    const uint8_t *frame = umem_ + desc.addr;
+    const uint8_t *ip = frame + ETH_HEADER_LEN;
+    const uint8_t *udp = ip + IPV4_HEADER_LEN;
+    if (desc.len < HEADERS_LEN or get_be16(udp + 4) < UDP_HEADER_LEN) {
+        count_malformed_datagram();
+        return datagram;  // cannot happen past the program; dropped like a timeout
+    }
+    const size_t payload_len = min(size_t(get_be16(udp + 4)) - UDP_HEADER_LEN, size_t(desc.len) - HEADERS_LEN);
+
+    /* as a dual-stack socket would see it: v4-mapped */
+    memset(&datagram.source_address, 0, sizeof(datagram.source_address));
+    datagram.source_address.sin6_family = AF_INET6;
+    datagram.source_address.sin6_addr.s6_addr[10] = 0xff;
+    datagram.source_address.sin6_addr.s6_addr[11] = 0xff;
+    memcpy(&datagram.source_address.sin6_addr.s6_addr[12], ip + 12, 4);
+    memcpy(&datagram.source_address.sin6_port, udp, 2);
+    datagram.payload.assign(reinterpret_cast<const char*>(udp + UDP_HEADER_LEN), payload_len);
+
+    /* headers of the answer: swap ethernet and ip addresses, from our port to the peer's */
+    memcpy(reply_headers_, frame, HEADERS_LEN);
+    memcpy(reply_headers_, frame + 6, 6);
+    memcpy(reply_headers_ + 6, frame, 6);
+    uint8_t *reply_ip = reply_headers_ + ETH_HEADER_LEN;
+    memcpy(reply_ip + 12, ip + 16, 4);
+    memcpy(reply_ip + 16, ip + 12, 4);
+    reply_ip[6] = 0x40;  // don't fragment
+    reply_ip[7] = 0;
+    reply_ip[8] = 64;    // ttl
+    uint8_t *reply_udp = reply_ip + IPV4_HEADER_LEN;
+    memcpy(reply_udp, udp + 2, 2);
+    memcpy(reply_udp + 2, &peer_.sin6_port, 2);
+    reply_headers_valid_ = true;
+
+    return datagram;
+}
+
+/* lay the reply headers and payload out in a frame; returns the frame length */
+size_t XdpReflector::build_reply(uint8_t *frame, const string &payload) const
+{
+    memcpy(frame, reply_headers_, HEADERS_LEN);
+    memcpy(frame + HEADERS_LEN, payload.data(), payload.size());
+
+    uint8_t *ip = frame + ETH_HEADER_LEN;
+    put_be16(ip + 2, IPV4_HEADER_LEN + UDP_HEADER_LEN + payload.size());
+    put_be16(ip + 10, 0);
+    const uint16_t checksum = ip_checksum(ip);
+    memcpy(ip + 10, &checksum, 2);
+
+    uint8_t *udp = ip + IPV4_HEADER_LEN;
+    put_be16(udp + 4, UDP_HEADER_LEN + payload.size());
+    put_be16(udp + 6, 0);  // no udp checksum (allowed over ipv4)
+    return HEADERS_LEN + payload.size();
+}
+
+void XdpReflector::transmit(const uint64_t addr, const size_t len)
+{
+    const uint32_t consumer = __atomic_load_n(tx_.consumer, __ATOMIC_ACQUIRE);
+    const uint32_t producer = *tx_.producer;
+    if (producer - consumer >= XDP_RING_SIZE) {
+        tx_dropped_++;
+        free_frames_.push_back(addr - addr % XDP_FRAME_SIZE);
+        return;
+    }
+    struct xdp_desc &desc = static_cast<struct xdp_desc*>(tx_.descs)[producer & (XDP_RING_SIZE - 1)];
+    desc.addr = addr;
+    desc.len = len;
+    desc.options = 0;
+    __atomic_store_n(tx_.producer, producer + 1, __ATOMIC_RELEASE);
+    tx_packets_++;
+
+    /* in copy mode the kernel only transmits when asked to */
+    sendto(xsk_, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+/* answer the last datagram with payload, in place of it */
+void XdpReflector::reflect(const string &payload)
+{
+    if (current_ == NO_FRAME or HEADERS_LEN + payload.size() > XDP_FRAME_SIZE - current_ % XDP_FRAME_SIZE) {
+        send(payload);
+        return;
+    }
+    const uint64_t addr = current_;
+    current_ = NO_FRAME;
+    transmit(addr, build_reply(umem_ + addr, payload));
+}
+
+/* send payload to the peer from a spare frame */
+void XdpReflector::send(const string &payload)
+{
+    if (not reply_headers_valid_ or HEADERS_LEN + payload.size() > XDP_FRAME_SIZE) {
+        send_packet(fd_, (struct sockaddr *) &peer_, sizeof(peer_), payload);
+        return;
+    }
+    if (free_frames_.empty()) {
+        reclaim_completions();
+    }
+    if (free_frames_.empty()) {
+        tx_dropped_++;
+        return;
+    }
+    const uint64_t addr = free_frames_.back();
+    free_frames_.pop_back();
+    transmit(addr, build_reply(umem_ + addr, payload));
+}
+
+/* Make human-readable representation of the counters */
+string XdpReflector::get_string() const
+{
+    struct xdp_statistics stats{};
+    socklen_t stats_len = sizeof(stats);
+    getsockopt(xsk_, SOL_XDP, XDP_STATISTICS, &stats, &stats_len);
+    return string_format("xdp: %s; rx %lu; socket rx %lu; tx %lu; tx dropped %lu; kernel rx dropped %llu; "
+                         "rx ring full %llu; fill ring empty %llu",
+                         mode_.c_str(),
+                         rx_packets_,
+                         socket_rx_packets_,
+                         tx_packets_,
+                         tx_dropped_,
+                         (unsigned long long) stats.rx_dropped,
+                         (unsigned long long) stats.rx_ring_full,
+                         (unsigned long long) stats.rx_fill_ring_empty_descs);
+}
+
+/* the AF_XDP reflector requested on the command line (--xdp), or null to stay
+   on the socket when none was requested or it cannot be set up */
+unique_ptr<XdpReflector> open_xdp_reflector(const int fd, const struct sockaddr_in6 &peer)
+{
+    if (run_options.xdp_ifname.empty()) {
+        return nullptr;
+    }
+    try {
+        unique_ptr<XdpReflector> reflector(new XdpReflector(fd, peer, run_options.xdp_ifname,
+                                                            run_options.xdp_queue, run_options.xdp_native));
+        Log("%s", reflector->mode().c_str());
+        return reflector;
+    } catch (const exception &e) {
+        Log("AF_XDP unavailable (%s); reflecting through the socket", e.what());
+        return nullptr;
+    }
+}
+
+#else
+
+using namespace std;
+
+/* built without AF_XDP support (see WITH_AF_XDP in CMakeLists.txt) */
+XdpReflector::XdpReflector(const int fd, const struct sockaddr_in6 &peer, const string &, const uint32_t, const bool)
+    : fd_(fd), peer_(peer)
+{
+    throw runtime_error("built without AF_XDP support");
+}
+
+XdpReflector::~XdpReflector() {}
+bool XdpReflector::wait_readable(const uint64_t timeout_us) { return ::wait_readable(fd_, timeout_us); }
+received_datagram XdpReflector::receive(const uint64_t, const bool spin) { return recv_packet(fd_, spin); }
+void XdpReflector::reflect(const string &payload) { send(payload); }
+void XdpReflector::send(const string &payload) { send_packet(fd_, (struct sockaddr *) &peer_, sizeof(peer_), payload); }
+string XdpReflector::get_string() const { return "xdp: off"; }
+
+unique_ptr<XdpReflector> open_xdp_reflector(const int, const struct sockaddr_in6 &)
+{
+    if (not run_options.xdp_ifname.empty()) {
+        Log("AF_XDP unavailable (built without AF_XDP support); reflecting through the socket");
+    }
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef UDP_XDP_REFLECTOR_H
+#define UDP_XDP_REFLECTOR_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+#include "packet.h"
+
+/* AF_XDP data path for the ack reflector. An XDP program on one receive queue
+   of an interface hands the UDP datagrams for our port to an AF_XDP socket.
+   They land in a UMEM region shared with the kernel; an ack is written over
+   the datagram in its own frame (addresses and ports swapped, lengths and IP
+   checksum fixed) and the frame is transmitted again, without going through
+   the socket layer. Generic (skb) mode works on any interface (on lo the
+   kernel drops the acks as martians, so test over veth); native mode needs
+   driver support and tries zero-copy first.
+
+   Only IPv4 datagrams without IP options on the chosen queue take this path
+   (IPv6 peers stay on the socket); everything else, such as flows RSS hashes
+   to other queues and datagrams queued before the program was attached,
+   still arrives on the socket, which is read alongside the AF_XDP socket for
+   the whole run. */
+class XdpReflector
+{
+public:
+    /* attach to a queue of ifname for the datagrams to the port fd is bound to;
+       acks go to peer. Throws when AF_XDP cannot be set up */
+    XdpReflector(int fd, const struct sockaddr_in6 &peer, const std::string &ifname, uint32_t queue, bool native);
+
+    /* detach the program and release the UMEM */
+    ~XdpReflector();
+
+    XdpReflector(const XdpReflector &) = delete;
+    XdpReflector &operator=(const XdpReflector &) = delete;
+
+    /* wait until a datagram is ready; returns false on timeout */
+    bool wait_readable(uint64_t timeout_us);
+
+    /* next datagram (no kernel receive timestamp), which stays in its
+       frame until the next call (an empty payload means the timeout
+       expired); with spin, poll without sleeping */
+    received_datagram receive(uint64_t timeout_ms, bool spin);
+
+    /* answer the last datagram with payload, in place of it */
+    void reflect(const std::string &payload);
+
+    /* send payload to the peer from a spare frame */
+    void send(const std::string &payload);
+
+    /* how the socket is attached */
+    const std::string &mode() const { return mode_; }
+
+    /* Make human-readable representation of the counters */
+    std::string get_string() const;
+
+private:
+    /* producer / consumer ring shared with the kernel */
+    struct Ring {
+        uint32_t *producer;
+        uint32_t *consumer;
+        void *descs;
+        void *map;
+        size_t map_len;
+    };
+
+    void map_ring(Ring &ring, uint64_t pgoff, uint64_t desc_offset, uint64_t producer_offset,
+                  uint64_t consumer_offset, size_t desc_size);
+    void release();
+    void attach_program(int ifindex, uint32_t queue, uint16_t port, bool native);
+    void refill();
+    void reclaim_completions();
+    void release_current();
+    size_t build_reply(uint8_t *frame, const std::string &payload) const;
+    void transmit(uint64_t addr, size_t len);
+
+    const int fd_;
+    const struct sockaddr_in6 peer_;
+    std::string mode_;
+
+    int xsk_;
+    uint8_t *umem_;
+    Ring fill_, completion_, rx_, tx_;
+    std::vector<uint64_t> free_frames_;
+    int map_fd_, prog_fd_, link_fd_;
+
+    uint64_t socket_turn_;           // frames taken since the socket was last checked
+    uint64_t current_;               // frame of the last datagram (-1 = none)
+    uint8_t reply_headers_[42];      // ethernet, ip and udp headers towards the peer
+    bool reply_headers_valid_;
+
+    uint64_t rx_packets_;
+    uint64_t socket_rx_packets_;     // datagrams that came through the socket instead
+    uint64_t tx_packets_;
+    uint64_t tx_dropped_;
+};
+
+/* the AF_XDP reflector requested on the command line (--xdp), or null to stay
+   on the socket when none was requested or it cannot be set up */
+std::unique_ptr<XdpReflector> open_xdp_reflector(int fd, const struct sockaddr_in6 &peer);
+
+#endif //UDP_XDP_REFLECTOR_H